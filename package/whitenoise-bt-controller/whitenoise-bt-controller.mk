@@ -9,4 +9,11 @@ WHITENOISE_BT_CONTROLLER_SITE = whitenoise-bt-controller
 WHITENOISE_BT_CONTROLLER_SITE_METHOD = local
 WHITENOISE_BT_CONTROLLER_DEPENDENCIES = qt5connectivity
 
+ifeq ($(BR2_PACKAGE_ALSA_LIB),y)
+WHITENOISE_BT_CONTROLLER_DEPENDENCIES += alsa-lib
+WHITENOISE_BT_CONTROLLER_CONF_OPTS += -DWHITENOISE_ALSA=ON
+else
+WHITENOISE_BT_CONTROLLER_CONF_OPTS += -DWHITENOISE_ALSA=OFF
+endif
+
 $(eval $(cmake-package))
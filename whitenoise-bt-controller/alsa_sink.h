@@ -0,0 +1,268 @@
+#ifndef WHITENOISE_BT_CONTROLLER_ALSA_SINK_H
+#define WHITENOISE_BT_CONTROLLER_ALSA_SINK_H
+
+#ifdef WHITENOISE_HAVE_ALSA
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <alsa/asoundlib.h>
+
+#include "audio_sink.h"
+#include "noise_device.h"
+#include "sample_format.h"
+
+// plays straight into an ALSA PCM in mmap mode. the device renders directly
+// into the hardware buffer from this sink's thread, which wakes up once per
+// period, so no render thread or ring is needed in front of it.
+class alsa_sink : public audio_sink {
+ public:
+  alsa_sink(noise_device &device,
+            std::string pcm_name,
+            unsigned long period_frames,
+            unsigned long buffer_frames)
+      : device(device),
+        pcm_name(std::move(pcm_name)),
+        period_frames(period_frames),
+        buffer_frames(buffer_frames) {
+  }
+
+  alsa_sink(const alsa_sink &) = delete;
+  alsa_sink &operator=(const alsa_sink &) = delete;
+
+  ~alsa_sink() override {
+    stop();
+  }
+
+  const char *name() const override {
+    return "alsa";
+  }
+
+  bool start() override {
+    if (pcm) {
+      return true;
+    }
+
+    if (!open_pcm()) {
+      if (pcm) {
+        snd_pcm_close(pcm);
+        pcm = nullptr;
+      }
+      return false;
+    }
+
+    running.store(true);
+    worker = std::thread([this]() {
+      run();
+    });
+
+    return true;
+  }
+
+  // closing the PCM is what lets the codec and the DMA power down
+  void suspend() override {
+    stop();
+  }
+
+  bool resume() override {
+    return start();
+  }
+
+  // without a period, the buffer is split into four
+  void setBufferFrames(unsigned long buffer, unsigned long period) override {
+    buffer_frames = buffer > 0 ? buffer : 4096;
+    period_frames = period > 0 ? period : std::max(buffer_frames / 4, 64ul);
+  }
+
+  void stop() override {
+    running.store(false);
+
+    if (worker.joinable()) {
+      worker.join();
+    }
+
+    if (pcm) {
+      snd_pcm_drop(pcm);
+      snd_pcm_close(pcm);
+      pcm = nullptr;
+    }
+  }
+
+ private:
+  bool check(int err, const char *what) {
+    if (err < 0) {
+      std::cerr << "alsa: " << what << " failed: " << snd_strerror(err) << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool open_pcm() {
+    if (!check(snd_pcm_open(&pcm, pcm_name.c_str(), SND_PCM_STREAM_PLAYBACK, 0), "open")) {
+      pcm = nullptr;
+      return false;
+    }
+
+    snd_pcm_hw_params_t *hw;
+    snd_pcm_hw_params_alloca(&hw);
+
+    unsigned int rate = noise_sample_rate;
+    snd_pcm_uframes_t period = period_frames;
+    snd_pcm_uframes_t buffer = buffer_frames;
+
+    if (!check(snd_pcm_hw_params_any(pcm, hw), "hw_params_any") ||
+        !check(snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED), "set mmap access") ||
+        !negotiate(hw) ||
+        !check(snd_pcm_hw_params_set_format(pcm, hw, alsa_format(format.encoding)), "set format") ||
+        !check(snd_pcm_hw_params_set_channels(pcm, hw, static_cast<unsigned int>(format.channels)), "set channels") ||
+        !check(snd_pcm_hw_params_set_rate_near(pcm, hw, &rate, nullptr), "set rate") ||
+        !check(snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, nullptr), "set period size") ||
+        !check(snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &buffer), "set buffer size") ||
+        !check(snd_pcm_hw_params(pcm, hw), "hw_params")) {
+      return false;
+    }
+
+    // noise_device resamples to whatever rate the PCM settled on
+    format.rate = rate;
+
+    snd_pcm_sw_params_t *sw;
+    snd_pcm_sw_params_alloca(&sw);
+
+    if (!check(snd_pcm_sw_params_current(pcm, sw), "sw_params_current") ||
+        !check(snd_pcm_sw_params_set_avail_min(pcm, sw, period), "set avail min") ||
+        !check(snd_pcm_sw_params_set_start_threshold(pcm, sw, buffer), "set start threshold") ||
+        !check(snd_pcm_sw_params(pcm, sw), "sw_params")) {
+      return false;
+    }
+
+    period_frames = period;
+    buffer_frames = buffer;
+    device.setOutputFormat(format);
+    device.setOutputBufferFrames(buffer_frames);
+
+    std::cerr << "alsa: opened " << pcm_name
+              << " as " << format.name()
+              << ", " << format.channels
+              << " channel(s) at " << format.rate
+              << " Hz with period " << period_frames
+              << " frames, buffer " << buffer_frames
+              << " frames" << std::endl;
+    return true;
+  }
+
+  static snd_pcm_format_t alsa_format(sample_encoding encoding) {
+    switch (encoding) {
+      case sample_encoding::u16:
+        return SND_PCM_FORMAT_U16_LE;
+      case sample_encoding::s24:
+        return SND_PCM_FORMAT_S24_3LE;
+      case sample_encoding::s32:
+        return SND_PCM_FORMAT_S32_LE;
+      case sample_encoding::f32:
+        return SND_PCM_FORMAT_FLOAT_LE;
+      default:
+        return SND_PCM_FORMAT_S16_LE;
+    }
+  }
+
+  // picks the first format in order of conversion cost that the PCM takes
+  // natively, so plug layers or the sound server do not convert for us
+  bool negotiate(snd_pcm_hw_params_t *hw) {
+    static const sample_encoding order[] = {sample_encoding::s16, sample_encoding::s32, sample_encoding::f32,
+                                            sample_encoding::s24, sample_encoding::u16};
+    bool found = false;
+
+    for (auto e : order) {
+      if (snd_pcm_hw_params_test_format(pcm, hw, alsa_format(e)) == 0) {
+        format.encoding = e;
+        found = true;
+        break;
+      }
+    }
+
+    if (!found) {
+      std::cerr << "alsa: " << pcm_name << " supports none of our sample formats" << std::endl;
+      return false;
+    }
+
+    if (snd_pcm_hw_params_test_channels(pcm, hw, noise_channels) == 0) {
+      format.channels = noise_channels;
+    } else if (snd_pcm_hw_params_test_channels(pcm, hw, 1) == 0) {
+      format.channels = 1;
+    } else {
+      std::cerr << "alsa: " << pcm_name << " takes neither stereo nor mono" << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  bool recover(int err) {
+    std::cerr << "alsa: recovering from: " << snd_strerror(err) << std::endl;
+    device.stats().recordStateChange(err == -EPIPE);
+    return check(snd_pcm_recover(pcm, err, 1), "recover");
+  }
+
+  void run() {
+    while (running.load(std::memory_order_relaxed)) {
+      snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+
+      if (avail < 0) {
+        if (!recover(static_cast<int>(avail))) {
+          return;
+        }
+        continue;
+      }
+
+      if (static_cast<snd_pcm_uframes_t>(avail) < period_frames) {
+        // the timeout only bounds how long stop() waits for this thread
+        int err = snd_pcm_wait(pcm, 100);
+        if (err < 0 && !recover(err)) {
+          return;
+        }
+        continue;
+      }
+
+      const snd_pcm_channel_area_t *areas;
+      snd_pcm_uframes_t offset;
+      snd_pcm_uframes_t frames = static_cast<snd_pcm_uframes_t>(avail);
+
+      int err = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
+      if (err < 0) {
+        if (!recover(err)) {
+          return;
+        }
+        continue;
+      }
+
+      char *dst = static_cast<char *>(areas[0].addr)
+          + areas[0].first / 8
+          + offset * areas[0].step / 8;
+      device.pullFrames(dst, frames);
+
+      snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm, offset, frames);
+      if (committed < 0 || static_cast<snd_pcm_uframes_t>(committed) != frames) {
+        if (!recover(committed < 0 ? static_cast<int>(committed) : -EPIPE)) {
+          return;
+        }
+      }
+    }
+  }
+
+  noise_device &device;
+  std::string pcm_name;
+  unsigned long period_frames;
+  unsigned long buffer_frames;
+  sample_format format;
+
+  snd_pcm_t *pcm = nullptr;
+  std::atomic<bool> running{false};
+  std::thread worker;
+};
+
+#endif //WHITENOISE_HAVE_ALSA
+
+#endif //WHITENOISE_BT_CONTROLLER_ALSA_SINK_H
@@ -0,0 +1,129 @@
+#ifndef WHITENOISE_BT_CONTROLLER_AUDIO_PARAMS_H
+#define WHITENOISE_BT_CONTROLLER_AUDIO_PARAMS_H
+
+#include <atomic>
+#include <memory>
+
+#include "fade_curve.h"
+#include "gain_ramp.h"
+#include "noise_source.h"
+
+static_assert(std::atomic<double>::is_always_lock_free, "audio parameters must be lock-free");
+static_assert(std::atomic<gain_mode>::is_always_lock_free, "audio parameters must be lock-free");
+static_assert(std::atomic<noise_source *>::is_always_lock_free, "audio parameters must be lock-free");
+static_assert(std::atomic<fade_curve>::is_always_lock_free, "audio parameters must be lock-free");
+
+// a fade as requested by the control side. a new generation restarts it;
+// zero frames means no fade.
+struct audio_fade {
+  unsigned int generation;
+  unsigned long frames;
+  fade_curve curve;
+  bool in;
+};
+
+// parameters as seen by the audio path for the duration of one buffer
+struct audio_params_snapshot {
+  double target_volume;
+  gain_mode mode;
+};
+
+// hands parameters from the control thread to the audio path without locks.
+// the control side may write at any time; the audio side takes one snapshot
+// per buffer, so a change is heard from the next buffer on.
+//
+// a new source is published through a single pending slot and picked up by
+// the audio side, which parks the source it replaced in a retired slot. the
+// control side deletes retired sources the next time it publishes, so the
+// audio path never frees memory. between two publishes the audio side can
+// retire at most two sources, hence two slots.
+class audio_params {
+ public:
+  audio_params() = default;
+
+  audio_params(const audio_params &) = delete;
+  audio_params &operator=(const audio_params &) = delete;
+
+  ~audio_params() {
+    delete pending_source.load();
+    reclaim();
+  }
+
+  // control side
+
+  void setTargetVolume(double vol) {
+    target_volume.store(vol, std::memory_order_relaxed);
+  }
+
+  void setGainMode(gain_mode mode) {
+    active_mode.store(mode, std::memory_order_relaxed);
+  }
+
+  // starts fading out (or in) over `frames` frames, or cancels any fade if
+  // zero
+  void setFade(unsigned long frames, fade_curve curve, bool in = false) {
+    fade_frames.store(frames, std::memory_order_relaxed);
+    active_fade_curve.store(curve, std::memory_order_relaxed);
+    fade_in.store(in, std::memory_order_relaxed);
+    fade_generation.fetch_add(1, std::memory_order_release);
+  }
+
+  void setSource(std::unique_ptr<noise_source> src) {
+    reclaim();
+
+    // a source that was never picked up was never seen by the audio side
+    delete pending_source.exchange(src.release(), std::memory_order_acq_rel);
+  }
+
+  // audio side
+
+  audio_params_snapshot snapshot() const {
+    return {target_volume.load(std::memory_order_relaxed),
+            active_mode.load(std::memory_order_relaxed)};
+  }
+
+  audio_fade fade() const {
+    unsigned int gen = fade_generation.load(std::memory_order_acquire);
+    return {gen,
+            fade_frames.load(std::memory_order_relaxed),
+            active_fade_curve.load(std::memory_order_relaxed),
+            fade_in.load(std::memory_order_relaxed)};
+  }
+
+  // swaps in a newly published source, if any
+  void updateSource(std::unique_ptr<noise_source> &active) {
+    noise_source *next = pending_source.exchange(nullptr, std::memory_order_acq_rel);
+
+    if (!next) {
+      return;
+    }
+
+    noise_source *old = active.release();
+    active.reset(next);
+
+    for (auto &slot : retired_sources) {
+      noise_source *empty = nullptr;
+      if (!old || slot.compare_exchange_strong(empty, old, std::memory_order_release)) {
+        return;
+      }
+    }
+  }
+
+ private:
+  void reclaim() {
+    for (auto &slot : retired_sources) {
+      delete slot.exchange(nullptr, std::memory_order_acquire);
+    }
+  }
+
+  std::atomic<double> target_volume{0};
+  std::atomic<gain_mode> active_mode{gain_mode::fixed};
+  std::atomic<unsigned long> fade_frames{0};
+  std::atomic<fade_curve> active_fade_curve{fade_curve::cosine};
+  std::atomic<bool> fade_in{false};
+  std::atomic<unsigned int> fade_generation{0};
+  std::atomic<noise_source *> pending_source{nullptr};
+  std::atomic<noise_source *> retired_sources[2] = {};
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_AUDIO_PARAMS_H
@@ -0,0 +1,24 @@
+#ifndef WHITENOISE_BT_CONTROLLER_AUDIO_SINK_H
+#define WHITENOISE_BT_CONTROLLER_AUDIO_SINK_H
+
+// an audio output that pulls PCM from a noise_device once started
+class audio_sink {
+ public:
+  virtual ~audio_sink() = default;
+
+  virtual const char *name() const = 0;
+
+  virtual bool start() = 0;
+  virtual void stop() = 0;
+
+  // output buffer and period in frames for the next start(); 0 leaves the
+  // choice to the backend. not every backend has a period to set.
+  virtual void setBufferFrames(unsigned long buffer_frames, unsigned long period_frames) = 0;
+
+  // stops pulling and lets the device idle, keeping it ready to resume.
+  // resume() returns false if the output could not be brought back.
+  virtual void suspend() = 0;
+  virtual bool resume() = 0;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_AUDIO_SINK_H
@@ -0,0 +1,171 @@
+#ifndef WHITENOISE_BT_CONTROLLER_AUDIO_STATS_H
+#define WHITENOISE_BT_CONTROLLER_AUDIO_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+// histogram buckets by microseconds: bucket 0 is under 1 us, bucket i holds
+// [2^(i-1), 2^i) us, and the last one everything from about 16 s up
+static constexpr unsigned long audio_stats_buckets = 16;
+
+struct audio_stats_snapshot {
+  uint64_t pulls;
+  uint64_t requested_bytes;
+  uint64_t delivered_bytes;
+  uint64_t render_underruns;  // the render ring ran dry
+  uint64_t output_underruns;  // the audio output starved anyway
+  uint64_t state_changes;
+  uint64_t pull_ns_total;
+  uint64_t pull_ns_max;
+  uint64_t pull_hist[audio_stats_buckets];    // time spent in one pull
+  uint64_t jitter_hist[audio_stats_buckets];  // change in time between pulls
+};
+
+// counts how well the audio output is fed. each counter has exactly one
+// writing thread (the one pulling audio, or whichever thread sees the
+// output's state changes) and is only ever stored with relaxed atomics, so
+// recording never takes a lock or a locked instruction. a snapshot may be a
+// count or two apart between fields.
+//
+// counters are 64 bits even on 32-bit targets, where byte and nanosecond
+// totals would otherwise wrap within a night. the package depends on 8-byte
+// atomic instructions, so those load and store without a lock or libatomic.
+class audio_stats {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  // pulling thread: one pull of `requested` bytes that produced `delivered`
+  void recordPull(unsigned long requested, unsigned long delivered, clock::time_point start,
+                  clock::time_point end) {
+    auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+    bump(pulls);
+    bump(requested_bytes, requested);
+    bump(delivered_bytes, delivered);
+    bump(pull_ns_total, ns);
+    if (ns > pull_ns_max.load(std::memory_order_relaxed)) {
+      pull_ns_max.store(ns, std::memory_order_relaxed);
+    }
+    bump(pull_hist[bucket(ns)]);
+
+    // the first pull after a restart has nothing sensible to compare with
+    if (restart_intervals.load(std::memory_order_relaxed)) {
+      restart_intervals.store(false, std::memory_order_relaxed);
+      last_start = clock::time_point();
+    }
+
+    if (last_start != clock::time_point()) {
+      auto interval = std::chrono::duration_cast<std::chrono::nanoseconds>(start - last_start).count();
+      if (last_interval >= 0) {
+        auto change = interval > last_interval ? interval - last_interval : last_interval - interval;
+        bump(jitter_hist[bucket(static_cast<uint64_t>(change))]);
+      }
+      last_interval = interval;
+    } else {
+      last_interval = -1;
+    }
+    last_start = start;
+  }
+
+  // pulling thread
+  void recordRenderUnderrun() {
+    bump(render_underruns);
+  }
+
+  // output state thread
+  void recordStateChange(bool underrun) {
+    bump(state_changes);
+    if (underrun) {
+      bump(output_underruns);
+    }
+  }
+
+  // any thread; call when pulls stop for a while on purpose, e.g. on suspend
+  void restartIntervals() {
+    restart_intervals.store(true, std::memory_order_relaxed);
+  }
+
+  uint64_t renderUnderruns() const {
+    return render_underruns.load(std::memory_order_relaxed);
+  }
+
+  audio_stats_snapshot snapshot() const {
+    audio_stats_snapshot s = {};
+    s.pulls = pulls.load(std::memory_order_relaxed);
+    s.requested_bytes = requested_bytes.load(std::memory_order_relaxed);
+    s.delivered_bytes = delivered_bytes.load(std::memory_order_relaxed);
+    s.render_underruns = render_underruns.load(std::memory_order_relaxed);
+    s.output_underruns = output_underruns.load(std::memory_order_relaxed);
+    s.state_changes = state_changes.load(std::memory_order_relaxed);
+    s.pull_ns_total = pull_ns_total.load(std::memory_order_relaxed);
+    s.pull_ns_max = pull_ns_max.load(std::memory_order_relaxed);
+    for (unsigned long i = 0; i < audio_stats_buckets; i++) {
+      s.pull_hist[i] = pull_hist[i].load(std::memory_order_relaxed);
+      s.jitter_hist[i] = jitter_hist[i].load(std::memory_order_relaxed);
+    }
+    return s;
+  }
+
+ private:
+  static void bump(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  static unsigned long bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    unsigned long b = 0;
+    while (us > 0 && b < audio_stats_buckets - 1) {
+      us >>= 1;
+      b++;
+    }
+    return b;
+  }
+
+  std::atomic<uint64_t> pulls{0};
+  std::atomic<uint64_t> requested_bytes{0};
+  std::atomic<uint64_t> delivered_bytes{0};
+  std::atomic<uint64_t> render_underruns{0};
+  std::atomic<uint64_t> output_underruns{0};
+  std::atomic<uint64_t> state_changes{0};
+  std::atomic<uint64_t> pull_ns_total{0};
+  std::atomic<uint64_t> pull_ns_max{0};
+  std::atomic<uint64_t> pull_hist[audio_stats_buckets] = {};
+  std::atomic<uint64_t> jitter_hist[audio_stats_buckets] = {};
+  std::atomic<bool> restart_intervals{false};
+
+  // pulling thread only
+  clock::time_point last_start;
+  long long last_interval = -1;
+};
+
+// one line of comma separated key=value pairs for the control protocol;
+// histograms are slash separated bucket counts
+inline std::string format_audio_stats(const audio_stats_snapshot &s) {
+  std::ostringstream out;
+
+  out << "pulls=" << s.pulls
+      << ",requested=" << s.requested_bytes
+      << ",delivered=" << s.delivered_bytes
+      << ",render_underruns=" << s.render_underruns
+      << ",output_underruns=" << s.output_underruns
+      << ",state_changes=" << s.state_changes
+      << ",pull_avg_us=" << (s.pulls ? s.pull_ns_total / s.pulls / 1000 : 0)
+      << ",pull_max_us=" << s.pull_ns_max / 1000;
+
+  out << ",pull_hist=";
+  for (unsigned long i = 0; i < audio_stats_buckets; i++) {
+    out << (i ? "/" : "") << s.pull_hist[i];
+  }
+
+  out << ",jitter_hist=";
+  for (unsigned long i = 0; i < audio_stats_buckets; i++) {
+    out << (i ? "/" : "") << s.jitter_hist[i];
+  }
+
+  return out.str();
+}
+
+#endif //WHITENOISE_BT_CONTROLLER_AUDIO_STATS_H
@@ -0,0 +1,103 @@
+#ifndef WHITENOISE_BT_CONTROLLER_COMMAND_TABLE_H
+#define WHITENOISE_BT_CONTROLLER_COMMAND_TABLE_H
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <string_view>
+#include <system_error>
+
+// most fields a protocol line is split into; anything past the last comma
+// that fits stays in the last field
+static constexpr std::size_t max_command_fields = 8;
+
+// splits a protocol line into the command name and its arguments at commas.
+// the fields point into `line`, which has to outlive them. returns the number
+// of fields, at least one.
+inline std::size_t split_command(std::string_view line, std::string_view (&fields)[max_command_fields]) {
+  std::size_t count = 0;
+
+  while (count < max_command_fields - 1) {
+    auto comma = line.find(',');
+    if (comma == std::string_view::npos) {
+      break;
+    }
+    fields[count++] = line.substr(0, comma);
+    line.remove_prefix(comma + 1);
+  }
+
+  fields[count++] = line;
+  return count;
+}
+
+// drops surrounding spaces, tabs and carriage returns
+inline std::string_view trim_field(std::string_view field) {
+  auto first = field.find_first_not_of(" \t\r");
+  if (first == std::string_view::npos) {
+    return {};
+  }
+  return field.substr(first, field.find_last_not_of(" \t\r") - first + 1);
+}
+
+// parses a whole field as a decimal integer. false for anything else,
+// including trailing garbage or a value out of range; never throws.
+inline bool parse_int(std::string_view field, int &value) {
+  field = trim_field(field);
+  if (!field.empty() && field[0] == '+') {
+    field.remove_prefix(1);
+  }
+
+  const char *end = field.data() + field.size();
+  auto result = std::from_chars(field.data(), end, value);
+  return !field.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+// the arguments of one command, after its name, without owning them
+template<typename T>
+class arg_span {
+ public:
+  constexpr arg_span(const T *args, std::size_t count) : args(args), count(count) {
+  }
+
+  constexpr std::size_t size() const {
+    return count;
+  }
+
+  constexpr const T &operator[](std::size_t i) const {
+    return args[i];
+  }
+
+ private:
+  const T *args;
+  std::size_t count;
+};
+
+// one protocol command. tables of these are built at compile time, sorted by
+// name, and searched by bisection, so dispatching a message neither allocates
+// nor hashes.
+template<typename Handler>
+struct command_entry {
+  std::string_view name;
+  Handler handler;
+};
+
+// for a static_assert next to each table; names must be strictly ascending
+template<typename Handler, std::size_t N>
+constexpr bool commands_sorted(const command_entry<Handler> (&table)[N]) {
+  for (std::size_t i = 1; i < N; i++) {
+    if (!(table[i - 1].name < table[i].name)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template<typename Handler, std::size_t N>
+const command_entry<Handler> *find_command(const command_entry<Handler> (&table)[N], std::string_view name) {
+  auto it = std::lower_bound(table, table + N, name, [](const command_entry<Handler> &entry, std::string_view n) {
+    return entry.name < n;
+  });
+  return it != table + N && it->name == name ? it : nullptr;
+}
+
+#endif //WHITENOISE_BT_CONTROLLER_COMMAND_TABLE_H
@@ -0,0 +1,59 @@
+#ifndef WHITENOISE_BT_CONTROLLER_FADE_CURVE_H
+#define WHITENOISE_BT_CONTROLLER_FADE_CURVE_H
+
+#include <algorithm>
+#include <cmath>
+#include <string_view>
+
+// shapes of the sleep timer fade-out and the fade-in on play
+enum class fade_curve {
+  linear,  // straight line in gain; sounds like it drops late
+  exp,     // straight line in dB down to -60, then to silence
+  cosine   // half cosine in gain; gentle at both ends
+};
+
+inline bool parse_fade_curve(std::string_view name, fade_curve &curve) {
+  if (name == "linear") {
+    curve = fade_curve::linear;
+  } else if (name == "exp") {
+    curve = fade_curve::exp;
+  } else if (name == "cosine") {
+    curve = fade_curve::cosine;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+inline const char *fade_curve_name(fade_curve curve) {
+  switch (curve) {
+    case fade_curve::linear:
+      return "linear";
+    case fade_curve::exp:
+      return "exp";
+    case fade_curve::cosine:
+      return "cosine";
+  }
+  return "?";
+}
+
+// gain factor at `progress` (0 to 1) through a fade; 1 at the start, 0 at
+// the end
+inline double fade_gain(fade_curve curve, double progress) {
+  progress = std::min(std::max(progress, 0.0), 1.0);
+
+  switch (curve) {
+    case fade_curve::linear:
+      return 1 - progress;
+    case fade_curve::exp: {
+      // offset so the curve lands exactly on zero
+      const double floor = .001;
+      return (std::pow(floor, progress) - floor) / (1 - floor);
+    }
+    case fade_curve::cosine:
+      return .5 + .5 * std::cos(M_PI * progress);
+  }
+  return 1;
+}
+
+#endif //WHITENOISE_BT_CONTROLLER_FADE_CURVE_H
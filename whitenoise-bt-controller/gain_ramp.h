@@ -0,0 +1,427 @@
+#ifndef WHITENOISE_BT_CONTROLLER_GAIN_RAMP_H
+#define WHITENOISE_BT_CONTROLLER_GAIN_RAMP_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+
+#if !defined(WHITENOISE_NO_SIMD)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define WHITENOISE_GAIN_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define WHITENOISE_GAIN_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define WHITENOISE_GAIN_NEON
+#endif
+#endif
+
+enum class gain_mode {
+  fixed,
+  floating
+};
+
+// per-sample volume change while ramping toward the target volume
+static const double gain_ramp_step = .000002;
+
+// fixed-point gains are kept in Q30 so the ramp step stays exact; samples are
+// scaled by the top bits as a Q14 gain, which leaves headroom for volumes
+// above 1.0 (up to just under 2.0).
+static const int gain_q_bits = 30;
+static const int gain_q_shift = 16;
+static const int32_t gain_q_ramp_step = 2147; // gain_ramp_step * 2^30
+static const int32_t gain_q_max = INT32_MAX;
+
+#if defined(WHITENOISE_GAIN_AVX2)
+static const unsigned long gain_lanes = 16;
+#elif defined(WHITENOISE_GAIN_SSE2) || defined(WHITENOISE_GAIN_NEON)
+static const unsigned long gain_lanes = 8;
+#else
+static const unsigned long gain_lanes = 1;
+#endif
+
+inline const char *gain_kernel_name() {
+#if defined(WHITENOISE_GAIN_AVX2)
+  return "avx2";
+#elif defined(WHITENOISE_GAIN_SSE2)
+  return "sse2";
+#elif defined(WHITENOISE_GAIN_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+inline int16_t gain_sample(const char *src, double gain) {
+  int16_t val;
+  std::memcpy(&val, src, 2);
+
+  double scaled = val * gain;
+  scaled = std::min(std::max(scaled, -32768.0), 32767.0);
+
+  return static_cast<int16_t>(scaled);
+}
+
+// scales gain_lanes samples from src into dst; sample i gets base + i * step.
+// src and dst need not be aligned.
+inline void gain_block(const char *src, char *dst, float base, float step) {
+#if defined(WHITENOISE_GAIN_AVX2)
+  const __m256 iota_lo = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256 iota_hi = _mm256_setr_ps(8, 9, 10, 11, 12, 13, 14, 15);
+  __m256 vstep = _mm256_set1_ps(step);
+  __m256 g_lo = _mm256_add_ps(_mm256_set1_ps(base), _mm256_mul_ps(iota_lo, vstep));
+  __m256 g_hi = _mm256_add_ps(_mm256_set1_ps(base), _mm256_mul_ps(iota_hi, vstep));
+
+  __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+  __m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(s));
+  __m256i hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(s, 1));
+
+  __m256i r_lo = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(lo), g_lo));
+  __m256i r_hi = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(hi), g_hi));
+
+  // packs works per 128-bit lane, so put the quadwords back in order afterwards
+  __m256i r = _mm256_permute4x64_epi64(_mm256_packs_epi32(r_lo, r_hi), 0xD8);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), r);
+#elif defined(WHITENOISE_GAIN_SSE2)
+  __m128 vstep = _mm_set1_ps(step);
+  __m128 g_lo = _mm_add_ps(_mm_set1_ps(base), _mm_mul_ps(_mm_setr_ps(0, 1, 2, 3), vstep));
+  __m128 g_hi = _mm_add_ps(_mm_set1_ps(base), _mm_mul_ps(_mm_setr_ps(4, 5, 6, 7), vstep));
+
+  __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+  __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+  __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+
+  __m128i r_lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(lo), g_lo));
+  __m128i r_hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(hi), g_hi));
+
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_packs_epi32(r_lo, r_hi));
+#elif defined(WHITENOISE_GAIN_NEON)
+  static const float iota_lo_f[4] = {0, 1, 2, 3};
+  static const float iota_hi_f[4] = {4, 5, 6, 7};
+  float32x4_t vbase = vdupq_n_f32(base);
+  float32x4_t g_lo = vmlaq_n_f32(vbase, vld1q_f32(iota_lo_f), step);
+  float32x4_t g_hi = vmlaq_n_f32(vbase, vld1q_f32(iota_hi_f), step);
+
+  int16x8_t s = vreinterpretq_s16_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(src)));
+  int32x4_t lo = vmovl_s16(vget_low_s16(s));
+  int32x4_t hi = vmovl_s16(vget_high_s16(s));
+
+  int32x4_t r_lo = vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(lo), g_lo));
+  int32x4_t r_hi = vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(hi), g_hi));
+
+  int16x8_t r = vcombine_s16(vqmovn_s32(r_lo), vqmovn_s32(r_hi));
+  vst1q_u8(reinterpret_cast<uint8_t *>(dst), vreinterpretq_u8_s16(r));
+#else
+  int16_t val = gain_sample(src, base);
+  std::memcpy(dst, &val, 2);
+  (void) step;
+#endif
+}
+
+// applies cur_volume to the int16 samples in src, writing them to dst, while
+// moving cur_volume linearly toward target_volume by ramp_step per sample.
+// once the ramp reaches the target the gain is held constant.
+inline void apply_gain_ramp(const char *src,
+                            char *dst,
+                            unsigned long samples,
+                            double &cur_volume,
+                            double target_volume,
+                            double ramp_step = gain_ramp_step) {
+  unsigned long i = 0;
+
+  while (i < samples) {
+    unsigned long remaining = samples - i;
+    double delta = target_volume - cur_volume;
+    double step = delta > 0 ? ramp_step : -ramp_step;
+    unsigned long ramp_len = 0;
+
+    if (delta != 0) {
+      ramp_len = static_cast<unsigned long>(std::ceil(std::fabs(delta) / ramp_step));
+      ramp_len = std::min(ramp_len, remaining);
+    } else {
+      step = 0;
+      ramp_len = remaining;
+    }
+
+    unsigned long j = 0;
+    for (; gain_lanes > 1 && j + gain_lanes <= ramp_len; j += gain_lanes) {
+      // recompute the block base in double so float error does not accumulate
+      float base = static_cast<float>(cur_volume + step * j);
+      gain_block(src + (i + j) * 2, dst + (i + j) * 2, base, static_cast<float>(step));
+    }
+    for (; j < ramp_len; j++) {
+      int16_t val = gain_sample(src + (i + j) * 2, cur_volume + step * j);
+      std::memcpy(dst + (i + j) * 2, &val, 2);
+    }
+
+    if (step != 0) {
+      cur_volume += step * ramp_len;
+      if ((step > 0 && cur_volume >= target_volume) || (step < 0 && cur_volume <= target_volume)) {
+        cur_volume = target_volume;
+      }
+    }
+
+    i += ramp_len;
+  }
+}
+
+inline int32_t gain_to_q(double gain) {
+  double q = std::ldexp(gain, gain_q_bits);
+  q = std::min(std::max(q, 0.0), static_cast<double>(gain_q_max));
+  return static_cast<int32_t>(std::lround(q));
+}
+
+inline double gain_from_q(int32_t q) {
+  return std::ldexp(static_cast<double>(q), -gain_q_bits);
+}
+
+inline int16_t gain_sample_q(const char *src, int32_t gain_q) {
+  int16_t val;
+  std::memcpy(&val, src, 2);
+
+  int32_t scaled = (static_cast<int32_t>(val) * (gain_q >> gain_q_shift)) >> (gain_q_bits - gain_q_shift);
+  scaled = std::min(std::max(scaled, static_cast<int32_t>(INT16_MIN)), static_cast<int32_t>(INT16_MAX));
+
+  return static_cast<int16_t>(scaled);
+}
+
+// fixed-point counterpart of gain_block: sample i gets (base + i * step) in Q30.
+// base + (gain_lanes - 1) * step must not exceed gain_q_max.
+inline void gain_block_q(const char *src, char *dst, int32_t base, int32_t step) {
+  const int product_shift = gain_q_bits - gain_q_shift;
+#if defined(WHITENOISE_GAIN_AVX2)
+  __m256i vbase = _mm256_set1_epi32(base);
+  __m256i vstep = _mm256_set1_epi32(step);
+  __m256i q_lo = _mm256_add_epi32(vbase, _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 8, 9, 10, 11), vstep));
+  __m256i q_hi = _mm256_add_epi32(vbase, _mm256_mullo_epi32(_mm256_setr_epi32(4, 5, 6, 7, 12, 13, 14, 15), vstep));
+  __m256i g = _mm256_packs_epi32(_mm256_srai_epi32(q_lo, gain_q_shift), _mm256_srai_epi32(q_hi, gain_q_shift));
+
+  __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+  __m256i p_lo16 = _mm256_mullo_epi16(s, g);
+  __m256i p_hi16 = _mm256_mulhi_epi16(s, g);
+
+  // unpack and packs both work per 128-bit lane, so the sample order survives
+  __m256i p_lo = _mm256_srai_epi32(_mm256_unpacklo_epi16(p_lo16, p_hi16), product_shift);
+  __m256i p_hi = _mm256_srai_epi32(_mm256_unpackhi_epi16(p_lo16, p_hi16), product_shift);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_packs_epi32(p_lo, p_hi));
+#elif defined(WHITENOISE_GAIN_SSE2)
+  __m128i vbase = _mm_set1_epi32(base);
+  __m128i q_lo = _mm_add_epi32(vbase, _mm_setr_epi32(0, step, 2 * step, 3 * step));
+  __m128i q_hi = _mm_add_epi32(vbase, _mm_setr_epi32(4 * step, 5 * step, 6 * step, 7 * step));
+  __m128i g = _mm_packs_epi32(_mm_srai_epi32(q_lo, gain_q_shift), _mm_srai_epi32(q_hi, gain_q_shift));
+
+  __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+  __m128i p_lo16 = _mm_mullo_epi16(s, g);
+  __m128i p_hi16 = _mm_mulhi_epi16(s, g);
+
+  __m128i p_lo = _mm_srai_epi32(_mm_unpacklo_epi16(p_lo16, p_hi16), product_shift);
+  __m128i p_hi = _mm_srai_epi32(_mm_unpackhi_epi16(p_lo16, p_hi16), product_shift);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_packs_epi32(p_lo, p_hi));
+#elif defined(WHITENOISE_GAIN_NEON)
+  static const int32_t iota_lo_q[4] = {0, 1, 2, 3};
+  static const int32_t iota_hi_q[4] = {4, 5, 6, 7};
+  int32x4_t vbase = vdupq_n_s32(base);
+  int32x4_t q_lo = vmlaq_n_s32(vbase, vld1q_s32(iota_lo_q), step);
+  int32x4_t q_hi = vmlaq_n_s32(vbase, vld1q_s32(iota_hi_q), step);
+  int16x4_t g_lo = vshrn_n_s32(q_lo, gain_q_shift);
+  int16x4_t g_hi = vshrn_n_s32(q_hi, gain_q_shift);
+
+  int16x8_t s = vreinterpretq_s16_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(src)));
+  int16x4_t r_lo = vqshrn_n_s32(vmull_s16(vget_low_s16(s), g_lo), gain_q_bits - gain_q_shift);
+  int16x4_t r_hi = vqshrn_n_s32(vmull_s16(vget_high_s16(s), g_hi), gain_q_bits - gain_q_shift);
+
+  vst1q_u8(reinterpret_cast<uint8_t *>(dst), vreinterpretq_u8_s16(vcombine_s16(r_lo, r_hi)));
+  (void) product_shift;
+#else
+  int16_t val = gain_sample_q(src, base);
+  std::memcpy(dst, &val, 2);
+  (void) step;
+  (void) product_shift;
+#endif
+}
+
+// steps a Q30 gain from cur_gain toward target_gain by ramp_step per sample
+// over `samples` samples, calling block(j, base, step) for runs of gain_lanes
+// samples whose gains stay in range and sample(j, gain) for the rest.
+template<typename Block, typename Sample>
+inline void for_each_gain_ramp_q(unsigned long samples,
+                                 int32_t &cur_gain,
+                                 int32_t target_gain,
+                                 Block block,
+                                 Sample sample,
+                                 int32_t ramp_step = gain_q_ramp_step) {
+  unsigned long i = 0;
+
+  while (i < samples) {
+    unsigned long remaining = samples - i;
+    int64_t delta = static_cast<int64_t>(target_gain) - cur_gain;
+    int32_t step = delta > 0 ? ramp_step : -ramp_step;
+    unsigned long ramp_len = 0;
+
+    if (delta != 0) {
+      int64_t abs_delta = delta > 0 ? delta : -delta;
+      ramp_len = static_cast<unsigned long>((abs_delta + ramp_step - 1) / ramp_step);
+      ramp_len = std::min(ramp_len, remaining);
+    } else {
+      step = 0;
+      ramp_len = remaining;
+    }
+
+    // the last step of a ramp may overshoot the target, so keep it out of the
+    // block loop where the gain would leave the Q14 range
+    unsigned long block_len = step != 0 ? ramp_len - 1 : ramp_len;
+
+    unsigned long j = 0;
+    for (; gain_lanes > 1 && j + gain_lanes <= block_len; j += gain_lanes) {
+      block(i + j, static_cast<int32_t>(cur_gain + static_cast<int64_t>(step) * j), step);
+    }
+    for (; j < ramp_len; j++) {
+      int64_t gain = cur_gain + static_cast<int64_t>(step) * j;
+      gain = std::min(std::max(gain, static_cast<int64_t>(0)), static_cast<int64_t>(gain_q_max));
+      sample(i + j, static_cast<int32_t>(gain));
+    }
+
+    if (step != 0) {
+      int64_t next = cur_gain + static_cast<int64_t>(step) * ramp_len;
+      if ((step > 0 && next >= target_gain) || (step < 0 && next <= target_gain)) {
+        next = target_gain;
+      }
+      cur_gain = static_cast<int32_t>(next);
+    }
+
+    i += ramp_len;
+  }
+}
+
+// fixed-point counterpart of apply_gain_ramp; cur_gain, target_gain and
+// ramp_step are Q30.
+inline void apply_gain_ramp_q(const char *src,
+                              char *dst,
+                              unsigned long samples,
+                              int32_t &cur_gain,
+                              int32_t target_gain,
+                              int32_t ramp_step = gain_q_ramp_step) {
+  for_each_gain_ramp_q(samples, cur_gain, target_gain,
+                       [src, dst](unsigned long j, int32_t base, int32_t step) {
+                         gain_block_q(src + j * 2, dst + j * 2, base, step);
+                       },
+                       [src, dst](unsigned long j, int32_t gain) {
+                         int16_t val = gain_sample_q(src + j * 2, gain);
+                         std::memcpy(dst + j * 2, &val, 2);
+                       },
+                       ramp_step);
+}
+
+// like gain_block_q, but adds the scaled samples to a 32-bit accumulator
+// instead of storing them
+inline void gain_accumulate_block_q(const int16_t *src, int32_t *acc, int32_t base, int32_t step) {
+  const int product_shift = gain_q_bits - gain_q_shift;
+#if defined(WHITENOISE_GAIN_AVX2)
+  __m256i vbase = _mm256_set1_epi32(base);
+  __m256i vstep = _mm256_set1_epi32(step);
+  __m256i q_lo = _mm256_add_epi32(vbase, _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 8, 9, 10, 11), vstep));
+  __m256i q_hi = _mm256_add_epi32(vbase, _mm256_mullo_epi32(_mm256_setr_epi32(4, 5, 6, 7, 12, 13, 14, 15), vstep));
+  __m256i g = _mm256_packs_epi32(_mm256_srai_epi32(q_lo, gain_q_shift), _mm256_srai_epi32(q_hi, gain_q_shift));
+
+  __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+  __m256i p_lo16 = _mm256_mullo_epi16(s, g);
+  __m256i p_hi16 = _mm256_mulhi_epi16(s, g);
+
+  // products come out as samples 0-3, 8-11 and 4-7, 12-15
+  __m256i p_a = _mm256_srai_epi32(_mm256_unpacklo_epi16(p_lo16, p_hi16), product_shift);
+  __m256i p_b = _mm256_srai_epi32(_mm256_unpackhi_epi16(p_lo16, p_hi16), product_shift);
+  __m256i p_first = _mm256_permute2x128_si256(p_a, p_b, 0x20);
+  __m256i p_second = _mm256_permute2x128_si256(p_a, p_b, 0x31);
+
+  auto *acc_v = reinterpret_cast<__m256i *>(acc);
+  _mm256_storeu_si256(acc_v, _mm256_add_epi32(_mm256_loadu_si256(acc_v), p_first));
+  _mm256_storeu_si256(acc_v + 1, _mm256_add_epi32(_mm256_loadu_si256(acc_v + 1), p_second));
+#elif defined(WHITENOISE_GAIN_SSE2)
+  __m128i vbase = _mm_set1_epi32(base);
+  __m128i q_lo = _mm_add_epi32(vbase, _mm_setr_epi32(0, step, 2 * step, 3 * step));
+  __m128i q_hi = _mm_add_epi32(vbase, _mm_setr_epi32(4 * step, 5 * step, 6 * step, 7 * step));
+  __m128i g = _mm_packs_epi32(_mm_srai_epi32(q_lo, gain_q_shift), _mm_srai_epi32(q_hi, gain_q_shift));
+
+  __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+  __m128i p_lo16 = _mm_mullo_epi16(s, g);
+  __m128i p_hi16 = _mm_mulhi_epi16(s, g);
+
+  __m128i p_lo = _mm_srai_epi32(_mm_unpacklo_epi16(p_lo16, p_hi16), product_shift);
+  __m128i p_hi = _mm_srai_epi32(_mm_unpackhi_epi16(p_lo16, p_hi16), product_shift);
+
+  auto *acc_v = reinterpret_cast<__m128i *>(acc);
+  _mm_storeu_si128(acc_v, _mm_add_epi32(_mm_loadu_si128(acc_v), p_lo));
+  _mm_storeu_si128(acc_v + 1, _mm_add_epi32(_mm_loadu_si128(acc_v + 1), p_hi));
+#elif defined(WHITENOISE_GAIN_NEON)
+  static const int32_t iota_lo_q[4] = {0, 1, 2, 3};
+  static const int32_t iota_hi_q[4] = {4, 5, 6, 7};
+  int32x4_t vbase = vdupq_n_s32(base);
+  int16x4_t g_lo = vshrn_n_s32(vmlaq_n_s32(vbase, vld1q_s32(iota_lo_q), step), gain_q_shift);
+  int16x4_t g_hi = vshrn_n_s32(vmlaq_n_s32(vbase, vld1q_s32(iota_hi_q), step), gain_q_shift);
+
+  int16x8_t s = vld1q_s16(src);
+  int32x4_t p_lo = vshrq_n_s32(vmull_s16(vget_low_s16(s), g_lo), gain_q_bits - gain_q_shift);
+  int32x4_t p_hi = vshrq_n_s32(vmull_s16(vget_high_s16(s), g_hi), gain_q_bits - gain_q_shift);
+
+  vst1q_s32(acc, vaddq_s32(vld1q_s32(acc), p_lo));
+  vst1q_s32(acc + 4, vaddq_s32(vld1q_s32(acc + 4), p_hi));
+  (void) product_shift;
+#else
+  acc[0] += (static_cast<int32_t>(src[0]) * (base >> gain_q_shift)) >> product_shift;
+  (void) step;
+#endif
+}
+
+// adds src scaled by a Q30 gain ramping from cur_gain toward target_gain to
+// acc. the sum is kept at sample scale, so many layers fit in 32 bits.
+inline void accumulate_gain_ramp_q(const int16_t *src,
+                                   int32_t *acc,
+                                   unsigned long samples,
+                                   int32_t &cur_gain,
+                                   int32_t target_gain) {
+  const int product_shift = gain_q_bits - gain_q_shift;
+
+  for_each_gain_ramp_q(samples, cur_gain, target_gain,
+                       [src, acc](unsigned long j, int32_t base, int32_t step) {
+                         gain_accumulate_block_q(src + j, acc + j, base, step);
+                       },
+                       [src, acc, product_shift](unsigned long j, int32_t gain) {
+                         acc[j] += (static_cast<int32_t>(src[j]) * (gain >> gain_q_shift)) >> product_shift;
+                       });
+}
+
+// saturates 32-bit accumulated samples down to int16
+inline void clamp_accumulator(const int32_t *acc, int16_t *out, unsigned long samples) {
+  unsigned long i = 0;
+
+#if defined(WHITENOISE_GAIN_AVX2)
+  for (; i + 16 <= samples; i += 16) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + i + 8));
+    __m256i r = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), r);
+  }
+#elif defined(WHITENOISE_GAIN_SSE2)
+  for (; i + 8 <= samples; i += 8) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + i + 4));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(a, b));
+  }
+#elif defined(WHITENOISE_GAIN_NEON)
+  for (; i + 8 <= samples; i += 8) {
+    int16x8_t r = vcombine_s16(vqmovn_s32(vld1q_s32(acc + i)), vqmovn_s32(vld1q_s32(acc + i + 4)));
+    vst1q_s16(out + i, r);
+  }
+#endif
+
+  for (; i < samples; i++) {
+    out[i] = static_cast<int16_t>(std::min(std::max(acc[i], static_cast<int32_t>(INT16_MIN)),
+                                           static_cast<int32_t>(INT16_MAX)));
+  }
+}
+
+#endif //WHITENOISE_BT_CONTROLLER_GAIN_RAMP_H
@@ -0,0 +1,237 @@
+#ifndef WHITENOISE_BT_CONTROLLER_IMA_ADPCM_H
+#define WHITENOISE_BT_CONTROLLER_IMA_ADPCM_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "noise_asset.h"
+#include "noise_source.h"
+
+// IMA-ADPCM noise assets: 4 bits per sample, a quarter of the size of raw
+// PCM. the file is a 20 byte header followed by fixed-size blocks:
+//
+//   header:  "WNA1", u16 channels, u16 0, u32 sample rate, u32 block frames,
+//            u32 total frames (all little endian)
+//   block:   per channel: s16 first sample, u8 step index, u8 0
+//            then one byte per remaining frame, left channel in the low
+//            nibble, right channel in the high nibble
+//
+// every block starts from an exact sample, so blocks decode independently
+// and errors do not build up over a long loop. the last block may hold fewer
+// than block frames valid frames.
+
+static const char adpcm_magic[4] = {'W', 'N', 'A', '1'};
+static const unsigned long adpcm_header_bytes = 20;
+static const unsigned long adpcm_default_block_frames = 1024;
+
+static const int16_t adpcm_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+    5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+    27086, 29794, 32767};
+
+static const int8_t adpcm_index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+struct adpcm_channel {
+  int32_t predictor = 0;
+  int32_t index = 0;
+
+  // the difference is computed as ((2 * magnitude + 1) * step) >> 3 rather
+  // than with the reference shift-and-add chain: it has no branches, and the
+  // encoder uses the same formula so the two never drift apart
+  int16_t decode(unsigned int nibble) {
+    int32_t step = adpcm_step_table[index];
+    int32_t diff = ((2 * static_cast<int32_t>(nibble & 7) + 1) * step) >> 3;
+    diff = (nibble & 8) ? -diff : diff;
+
+    predictor = std::min(std::max(predictor + diff, -32768), 32767);
+    index = std::min(std::max(index + adpcm_index_table[nibble], 0), 88);
+    return static_cast<int16_t>(predictor);
+  }
+
+  unsigned int encode(int16_t sample) {
+    int32_t step = adpcm_step_table[index];
+    int32_t diff = sample - predictor;
+    unsigned int sign = diff < 0 ? 8 : 0;
+    int32_t magnitude = std::min((std::abs(diff) * 4) / step, 7);
+
+    unsigned int nibble = sign | static_cast<unsigned int>(magnitude);
+    decode(nibble);
+    return nibble;
+  }
+};
+
+inline unsigned long adpcm_block_bytes(unsigned long block_frames) {
+  return noise_channels * 4 + (block_frames - 1);
+}
+
+// decodes one block of interleaved stereo; `frames` may be less than the
+// block size for the last block
+inline void adpcm_decode_block(const uint8_t *block, int16_t *out, unsigned long frames) {
+  adpcm_channel left;
+  adpcm_channel right;
+
+  left.predictor = static_cast<int16_t>(block[0] | (block[1] << 8));
+  left.index = std::min<int32_t>(block[2], 88);
+  right.predictor = static_cast<int16_t>(block[4] | (block[5] << 8));
+  right.index = std::min<int32_t>(block[6], 88);
+
+  out[0] = static_cast<int16_t>(left.predictor);
+  out[1] = static_cast<int16_t>(right.predictor);
+
+  // the two channels are independent chains, which keeps both in flight
+  const uint8_t *nibbles = block + noise_channels * 4;
+  for (unsigned long i = 1; i < frames; i++) {
+    uint8_t b = nibbles[i - 1];
+    out[i * 2] = left.decode(b & 0xf);
+    out[i * 2 + 1] = right.decode(b >> 4);
+  }
+}
+
+// encodes interleaved stereo into one block of block_frames frames. frames
+// past `frames` are padded with silence.
+inline void adpcm_encode_block(const int16_t *in, unsigned long frames, unsigned long block_frames,
+                               adpcm_channel state[2], uint8_t *block) {
+  std::memset(block, 0, adpcm_block_bytes(block_frames));
+
+  for (unsigned long c = 0; c < 2; c++) {
+    auto first = static_cast<uint16_t>(in[c]);
+    state[c].predictor = in[c];
+    block[c * 4] = static_cast<uint8_t>(first & 0xff);
+    block[c * 4 + 1] = static_cast<uint8_t>(first >> 8);
+    block[c * 4 + 2] = static_cast<uint8_t>(state[c].index);
+  }
+
+  uint8_t *nibbles = block + noise_channels * 4;
+  for (unsigned long i = 1; i < block_frames; i++) {
+    int16_t l = i < frames ? in[i * 2] : 0;
+    int16_t r = i < frames ? in[i * 2 + 1] : 0;
+    nibbles[i - 1] = static_cast<uint8_t>(state[0].encode(l) | (state[1].encode(r) << 4));
+  }
+}
+
+struct adpcm_header {
+  unsigned long channels;
+  unsigned long sample_rate;
+  unsigned long block_frames;
+  unsigned long frames;
+};
+
+inline void adpcm_write_u32(uint8_t *p, unsigned long v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = static_cast<uint8_t>(v >> (8 * i));
+  }
+}
+
+inline unsigned long adpcm_read_u32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<unsigned long>(p[3]) << 24);
+}
+
+inline void adpcm_write_header(const adpcm_header &h, uint8_t *p) {
+  std::memcpy(p, adpcm_magic, 4);
+  p[4] = static_cast<uint8_t>(h.channels);
+  p[5] = 0;
+  p[6] = 0;
+  p[7] = 0;
+  adpcm_write_u32(p + 8, h.sample_rate);
+  adpcm_write_u32(p + 12, h.block_frames);
+  adpcm_write_u32(p + 16, h.frames);
+}
+
+inline bool adpcm_read_header(const uint8_t *p, unsigned long size, adpcm_header &h) {
+  if (size < adpcm_header_bytes || std::memcmp(p, adpcm_magic, 4) != 0) {
+    return false;
+  }
+
+  h.channels = p[4] | (p[5] << 8);
+  h.sample_rate = adpcm_read_u32(p + 8);
+  h.block_frames = adpcm_read_u32(p + 12);
+  h.frames = adpcm_read_u32(p + 16);
+  return true;
+}
+
+// loops an IMA-ADPCM asset, decoding one block at a time as it is pulled. the
+// compressed file stays mapped; only one decoded block is held in memory.
+// with a render thread this runs ahead of playback like any other source.
+class adpcm_loop_source : public noise_source {
+ public:
+  explicit adpcm_loop_source(const char *path) {
+    if (!asset.load(path)) {
+      return;
+    }
+
+    auto *data = reinterpret_cast<const uint8_t *>(asset.data());
+    adpcm_header h = {};
+
+    if (!adpcm_read_header(data, asset.size(), h) || h.channels != noise_channels || h.block_frames < 2) {
+      std::cerr << path << " is not a stereo noise ADPCM file" << std::endl;
+      return;
+    }
+
+    rate = h.sample_rate;
+    block_frames = h.block_frames;
+    block_bytes = adpcm_block_bytes(block_frames);
+    blocks = data + adpcm_header_bytes;
+
+    // ignore a truncated tail rather than read past the end
+    unsigned long needed = (h.frames + block_frames - 1) / block_frames;
+    unsigned long stored = (asset.size() - adpcm_header_bytes) / block_bytes;
+    block_count = std::min(stored, needed);
+    last_block_frames = block_frames;
+    if (block_count == needed && block_count > 0) {
+      last_block_frames = h.frames - (block_count - 1) * block_frames;
+    }
+
+    std::cerr << "ADPCM noise file has " << block_count << " blocks of " << block_frames << " frames" << std::endl;
+    decoded.resize(block_frames * noise_channels);
+  }
+
+  bool valid() const {
+    return block_count > 0;
+  }
+
+  // what the asset was recorded at; make_noise_source() resamples from it
+  unsigned long sampleRate() const {
+    return rate;
+  }
+
+  const int16_t *pull(int16_t *scratch, unsigned long &samples) override {
+    if (block_count == 0) {
+      std::fill(scratch, scratch + samples, 0);
+      return scratch;
+    }
+
+    if (pos == decoded_samples) {
+      unsigned long frames = cur_block == block_count - 1 ? last_block_frames : block_frames;
+      adpcm_decode_block(blocks + cur_block * block_bytes, decoded.data(), frames);
+      decoded_samples = frames * noise_channels;
+      pos = 0;
+      cur_block = (cur_block + 1) % block_count;
+    }
+
+    samples = std::min(samples, decoded_samples - pos);
+    const int16_t *out = decoded.data() + pos;
+    pos += samples;
+    return out;
+  }
+
+ private:
+  noise_asset asset;
+  const uint8_t *blocks = nullptr;
+  unsigned long rate = noise_sample_rate;
+  unsigned long block_frames = 0;
+  unsigned long block_bytes = 0;
+  unsigned long block_count = 0;
+  unsigned long last_block_frames = 0;
+
+  std::vector<int16_t> decoded;
+  unsigned long decoded_samples = 0;
+  unsigned long cur_block = 0;
+  unsigned long pos = 0;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_IMA_ADPCM_H
@@ -1,13 +1,20 @@
 #include <algorithm>
+#include <bitset>
+#include <charconv>
+#include <cstdlib>
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <future>
 #include <string>
-
-#include <unistd.h>
+#include <string_view>
+#include <memory>
 
 #include <QDebug>
 #include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
 #include <QtBluetooth>
 #include <QtMultimedia>
 
@@ -16,12 +23,78 @@
 #include <BluezQt/Device>
 #include <QtBluetooth/QBluetoothLocalDevice>
 
+#include "alsa_sink.h"
+#include "audio_sink.h"
+#include "audio_stats.h"
+#include "command_table.h"
 #include "noise_device.h"
+#include "noise_mixer.h"
+#include "qt_audio_sink.h"
+#include "resampler.h"
+#include "send_queue.h"
+#include "state_store.h"
 
 static const QLatin1String BT_SERVER_UUID("3bb45162-cecf-4bcb-be9f-026ec7ab38be");
 
+// output buffer sizes auto-tuning picks from, in frames
+static const unsigned long min_buffer_frames = 256;
+static const unsigned long max_buffer_frames = 16384;
+
+// auto-tuning only grows the buffer once underruns keep coming back: in at
+// least this many of the last underrun_window stats intervals
+static const unsigned int underrun_window = 10;
+static const unsigned long underrun_intervals_to_grow = 3;
+
+// blocks rendered to measure what rendering costs, and how often the event
+// loop checks whether the measurement has finished
+static const unsigned long autotune_blocks = 400;
+static const int autotune_poll_ms = 50;
+
+// longest protocol line accepted from a client, in bytes
+static const unsigned long max_line_bytes = 1024;
+
+// longest sleep timer, and longest fade; QTimer intervals are int ms
+static const qint64 max_sleep_ms = 24 * 60 * 60000;
+
+// how much a client may have outstanding. the socket's own buffer is only
+// topped up while it holds less than the low-water mark; a client that
+// stays over the high-water mark for client_stall_ms, or whose unsent
+// replies outgrow it, is disconnected.
+static const unsigned long client_low_water_bytes = 4096;
+static const unsigned long client_high_water_bytes = 16384;
+static const qint64 client_stall_ms = 30000;
+
+// the slowest render block seen by one measurement, and its size
+struct render_cost {
+  unsigned long worst_ns;
+  unsigned long block_frames;
+};
+
+// one connected phone
+struct client_connection {
+  QBluetoothSocket *socket;
+
+  // bytes received but not yet split into lines. kept for the life of the
+  // connection so that reading reuses its capacity.
+  std::string received;
+  // set once an overlong line has been dropped, until the rest of it has
+  // been skipped up to its newline
+  bool discarding = false;
+
+  // the status frame this client was last sent
+  std::string last_status;
+
+  send_queue queue{client_high_water_bytes};
+  // when the client went over the high-water mark; 0 while it is under
+  qint64 over_since = 0;
+  bool closing = false;
+};
+
 struct app_context {
-  std::vector<QBluetoothSocket *> client_sockets;
+  std::vector<std::unique_ptr<client_connection>> clients;
+  // rebuilt by report_status() on every change; kept to reuse its capacity
+  std::string status_frame;
+  std::string send_buffer;
 
   BluezQt::Manager manager;
 
@@ -34,79 +107,268 @@ struct app_context {
 
   QTimer scan_timer;
   QTimer advertise_timer;
+  QTimer stats_timer;
+  QTimer sleep_fade_timer;
+  QTimer sleep_timer;
+  QTimer suspend_timer;
+  QTimer autotune_timer;
+
+  // when the sleep timer stops playback, in ms since the epoch; 0 if unset
+  qint64 sleep_deadline = 0;
+  bool sleep_fading = false;
+  bool suspended = false;
+
+  // output buffer (0 leaves it to the backend) and render block, in frames
+  unsigned long buffer_frames = 0;
+  unsigned long block_frames = 1024;
+  // what the last render cost measurement asked for; 0 until there is one
+  unsigned long tuned_buffer_frames = 0;
+  // auto-tuning never goes below this again once it has seen underruns
+  unsigned long tuned_floor_frames = min_buffer_frames;
+  // a measurement running off the event loop; invalid when none is
+  std::future<render_cost> autotune_result;
+  uint64_t tuned_underruns = 0;
+  // a bit per stats interval that saw underruns, the newest lowest
+  unsigned int underrun_history = 0;
 
   bool playing = false;
+  std::unique_ptr<state_store> state;
   noise_device noise;
-  QAudioOutput *player = nullptr;
+  // owned by the renderer once handed to it; null unless player.layers is set
+  noise_mixer *mixer = nullptr;
+  resample_quality quality = resample_quality::medium;
+  std::unique_ptr<audio_sink> sink;
 };
 
+client_connection *find_client(app_context &ctx, QBluetoothSocket *socket) {
+  for (const auto &client : ctx.clients) {
+    if (client->socket == socket) {
+      return client.get();
+    }
+  }
+  return nullptr;
+}
+
 void client_disconnected(app_context &ctx,
                          QBluetoothSocket *socket) {
+  // dropping a client may have got here first
+  if (!find_client(ctx, socket)) {
+    return;
+  }
+
   std::cerr << "client disconnected: " << socket->peerName().toStdString() << std::endl;
 
-  ctx.client_sockets.erase(
-      std::remove(ctx.client_sockets.begin(),
-                  ctx.client_sockets.end(),
-                  socket),
-      ctx.client_sockets.end());
+  ctx.clients.erase(
+      std::remove_if(ctx.clients.begin(),
+                     ctx.clients.end(),
+                     [socket](const std::unique_ptr<client_connection> &client) {
+                       return client->socket == socket;
+                     }),
+      ctx.clients.end());
 
   socket->deleteLater();
 }
 
-std::vector<std::string> parse_cmd(const std::string &cmd) {
-  std::string delim = ",";
-  std::vector<std::string> cmdv;
+// disconnects a client that is not keeping up. the socket is closed from the
+// event loop, since this may run while the client list is being walked.
+void drop_client(app_context &ctx, client_connection &client) {
+  if (client.closing) {
+    return;
+  }
+
+  std::cerr << "client " << client.socket->peerName().toStdString()
+            << " is not reading its messages; disconnecting" << std::endl;
+  client.closing = true;
+
+  QBluetoothSocket *socket = client.socket;
+  QTimer::singleShot(0, socket, [&ctx, socket]() {
+    socket->abort();
+    client_disconnected(ctx, socket);
+  });
+}
+
+// hands queued messages to the socket while its own buffer is low
+void flush_client(app_context &ctx, client_connection &client) {
+  if (client.closing) {
+    return;
+  }
 
-  unsigned long start = 0U;
-  unsigned long end = cmd.find(delim);
+  QBluetoothSocket *socket = client.socket;
+  auto buffered = static_cast<unsigned long>(std::max<qint64>(socket->bytesToWrite(), 0));
 
-  while (end != std::string::npos) {
-    cmdv.emplace_back(cmd.substr(start, end - start));
-    start = end + delim.length();
-    end = cmd.find(delim, start);
+  if (buffered < client_low_water_bytes && !client.queue.empty()) {
+    ctx.send_buffer.clear();
+    client.queue.take(ctx.send_buffer, client_low_water_bytes - buffered);
+    socket->write(ctx.send_buffer.data(), static_cast<qint64>(ctx.send_buffer.size()));
+    buffered = static_cast<unsigned long>(std::max<qint64>(socket->bytesToWrite(), 0));
   }
 
-  cmdv.emplace_back(cmd.substr(start, end));
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  if (buffered + client.queue.queuedBytes() <= client_high_water_bytes) {
+    client.over_since = 0;
+  } else if (client.over_since == 0) {
+    client.over_since = now;
+
+    // check back even if nothing else is queued or written meanwhile
+    QTimer::singleShot(static_cast<int>(client_stall_ms) + 1, socket, [&ctx, socket]() {
+      client_connection *stalled = find_client(ctx, socket);
+      if (stalled) {
+        flush_client(ctx, *stalled);
+      }
+    });
+  } else if (now - client.over_since > client_stall_ms) {
+    drop_client(ctx, client);
+  }
+}
 
-  return cmdv;
+void send_reply(app_context &ctx, client_connection &client, std::string_view line) {
+  if (client.closing) {
+    return;
+  }
+
+  if (!client.queue.pushReply(line)) {
+    drop_client(ctx, client);
+    return;
+  }
+
+  flush_client(ctx, client);
 }
 
+// the state store writes this out in the background once changes settle
 void save_state(app_context &ctx) {
-  ctx.settings.setValue("player.playing", ctx.playing);
-  ctx.settings.setValue("player.volume", ctx.noise.volume());
-  sync();
+  ctx.state->set("player.playing", ctx.playing ? "true" : "false");
+  ctx.state->set("player.volume", std::to_string(ctx.noise.volume()));
+}
+
+// kept with the playing state, so that after a power cut the player never
+// comes back playing without the timer that was meant to stop it; 0 if unset
+void save_sleep_deadline(app_context &ctx) {
+  ctx.state->set("timer.deadline", std::to_string(ctx.sleep_deadline));
+}
+
+// player state used to be kept in QSettings, so fall back to that
+bool saved_state(app_context &ctx, const char *key, std::string &value) {
+  if (ctx.state->get(key, value)) {
+    return true;
+  }
+
+  if (ctx.settings.contains(key)) {
+    value = ctx.settings.value(key).toString().toStdString();
+    return true;
+  }
+
+  return false;
+}
+
+void append_int(std::string &out, long long value) {
+  char digits[24];
+  auto result = std::to_chars(digits, digits + sizeof(digits), value);
+  out.append(digits, result.ptr);
 }
 
+// builds the status frame once and queues it for every client that has not
+// already been sent exactly that
 void report_status(app_context &ctx) {
-  qreal vol = ctx.noise.volume();
-
-  for (const auto &socket : ctx.client_sockets) {
-    socket->write("VOL,");
-    socket->write(std::to_string(static_cast<int>(vol * 100)).c_str());
-    socket->write("\n");
-
-    if (ctx.connected_speaker) {
-      socket->write("CONNECTED_SPEAKER,");
-      socket->write(ctx.speaker_device.toString().toStdString().c_str());
-      socket->write("\n");
-    } else {
-      socket->write("DISCONNECTED_SPEAKER");
-      socket->write("\n");
-    }
+  std::string &frame = ctx.status_frame;
+  frame.clear();
+
+  frame += "VOL,";
+  append_int(frame, static_cast<int>(ctx.noise.volume() * 100));
+  frame += "\n";
+
+  if (ctx.connected_speaker) {
+    frame += "CONNECTED_SPEAKER,";
+    frame += ctx.speaker_device.toString().toLatin1().constData();
+    frame += "\n";
+  } else {
+    frame += "DISCONNECTED_SPEAKER\n";
+  }
 
-    if (ctx.playing) {
-      socket->write("PLAYING");
-      socket->write("\n");
-    } else {
-      socket->write("STOPPED");
-      socket->write("\n");
+  frame += ctx.playing ? "PLAYING\n" : "STOPPED\n";
+
+  if (ctx.sleep_deadline != 0) {
+    qint64 left_ms = ctx.sleep_deadline - QDateTime::currentMSecsSinceEpoch();
+    frame += "TIMER,";
+    append_int(frame, std::max<qint64>(left_ms + 59999, 0) / 60000);
+    frame += "\n";
+  }
+
+  for (const auto &client : ctx.clients) {
+    if (client->last_status == frame) {
+      continue;
     }
+
+    // a status still waiting in the queue is simply replaced
+    client->queue.setStatus(frame);
+    client->last_status.assign(frame);
+    flush_client(ctx, *client);
+  }
+}
+
+void resume_output(app_context &ctx) {
+  if (!ctx.suspended) {
+    return;
+  }
+
+  std::cerr << "resuming audio output" << std::endl;
+  ctx.noise.resume();
+
+  if (!ctx.sink->resume()) {
+    // stay suspended, so the next PLAY tries again
+    std::cerr << "could not resume " << ctx.sink->name() << " audio output" << std::endl;
+    ctx.noise.suspend();
+    return;
+  }
+  ctx.suspended = false;
+}
+
+// suspends the audio output and the render thread once everything still
+// queued has played out, checking back a few times a second until then
+void suspend_when_silent(app_context &ctx) {
+  if (ctx.suspended || ctx.playing || !ctx.sink) {
+    return;
+  }
+
+  if (!ctx.noise.silent()) {
+    ctx.suspend_timer.start();
+    return;
+  }
+
+  std::cerr << "output is silent; suspending audio output" << std::endl;
+  ctx.sink->suspend();
+  ctx.noise.suspend();
+  ctx.suspended = true;
+}
+
+void cancel_sleep_timer(app_context &ctx) {
+  ctx.sleep_fade_timer.stop();
+  ctx.sleep_timer.stop();
+  ctx.sleep_deadline = 0;
+  save_sleep_deadline(ctx);
+
+  if (ctx.sleep_fading) {
+    ctx.noise.cancelFade();
+    ctx.sleep_fading = false;
   }
 }
 
 void play(app_context &ctx) {
   std::cerr << "playing sound" << std::endl;
 
+  // playing again means whoever set the sleep timer is still awake
+  if (ctx.sleep_fading) {
+    std::cerr << "cancelling sleep timer during its fade" << std::endl;
+    cancel_sleep_timer(ctx);
+  }
+
+  resume_output(ctx);
+
+  if (!ctx.playing) {
+    fade_curve curve = fade_curve::cosine;
+    parse_fade_curve(ctx.settings.value("player.fade_in_curve", "cosine").toString().toStdString(), curve);
+    ctx.noise.fadeIn(ctx.settings.value("player.fade_in_ms", 2000).toULongLong(), curve);
+  }
+
   ctx.playing = true;
   ctx.noise.unquiet();
 
@@ -114,20 +376,138 @@ void play(app_context &ctx) {
   save_state(ctx);
 }
 
+void stop(app_context &ctx) {
+  std::cerr << "stopping sound" << std::endl;
+  ctx.noise.quiet();
+  ctx.playing = false;
+  report_status(ctx);
+  save_state(ctx);
+
+  // rather than render and stream silence, idle once the ramp is down
+  suspend_when_silent(ctx);
+}
+
+void start_sleep_fade(app_context &ctx, unsigned long seconds) {
+  fade_curve curve = fade_curve::cosine;
+  parse_fade_curve(ctx.settings.value("timer.curve", "cosine").toString().toStdString(), curve);
+
+  std::cerr << "sleep timer fading out over " << seconds << " s ("
+            << fade_curve_name(curve) << ")" << std::endl;
+  ctx.noise.startFade(seconds, curve);
+  ctx.sleep_fading = true;
+}
+
+void sleep_timer_expired(app_context &ctx) {
+  std::cerr << "sleep timer expired" << std::endl;
+
+  stop(ctx);
+  cancel_sleep_timer(ctx);
+  report_status(ctx);
+}
+
+// schedules the fade and the stop for the current deadline. both are single
+// shot timers, so nothing runs in between.
+void arm_sleep_timer(app_context &ctx) {
+  ctx.sleep_fade_timer.stop();
+  ctx.sleep_timer.stop();
+
+  if (ctx.sleep_deadline == 0) {
+    return;
+  }
+
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  qint64 left_ms = ctx.sleep_deadline - now;
+  if (left_ms <= 0) {
+    sleep_timer_expired(ctx);
+    return;
+  }
+
+  // a saved deadline further out than any timer could be set for means the
+  // clock has jumped since; count from now instead
+  if (left_ms > max_sleep_ms) {
+    std::cerr << "sleep timer deadline too far ahead; limiting it to 24 hours" << std::endl;
+    left_ms = max_sleep_ms;
+    ctx.sleep_deadline = now + left_ms;
+    save_sleep_deadline(ctx);
+  }
+
+  qint64 fade_ms = std::min(std::max<qint64>(ctx.settings.value("timer.fade_s", 60).toLongLong(), 0) * 1000,
+                            max_sleep_ms);
+  ctx.sleep_timer.start(static_cast<int>(left_ms));
+
+  if (left_ms > fade_ms) {
+    ctx.sleep_fade_timer.start(static_cast<int>(left_ms - fade_ms));
+  } else {
+    start_sleep_fade(ctx, static_cast<unsigned long>(left_ms / 1000));
+  }
+}
+
+void set_sleep_timer(app_context &ctx, int minutes) {
+  cancel_sleep_timer(ctx);
+
+  if (minutes <= 0) {
+    std::cerr << "sleep timer cancelled" << std::endl;
+    report_status(ctx);
+    return;
+  }
+
+  minutes = std::min(minutes, static_cast<int>(max_sleep_ms / 60000));
+  std::cerr << "sleep timer set for " << minutes << " minutes" << std::endl;
+
+  ctx.sleep_deadline = QDateTime::currentMSecsSinceEpoch() + static_cast<qint64>(minutes) * 60000;
+  save_sleep_deadline(ctx);
+  arm_sleep_timer(ctx);
+  report_status(ctx);
+}
+
 void restore_state(app_context &ctx) {
-  if (ctx.settings.contains("player.playing")) {
-    bool playing = ctx.settings.value("player.playing").toBool();
+  std::string value;
+
+  if (saved_state(ctx, "timer.deadline", value)) {
+    ctx.sleep_deadline = std::strtoll(value.c_str(), nullptr, 10);
+
+    if (ctx.sleep_deadline != 0 && ctx.sleep_deadline <= QDateTime::currentMSecsSinceEpoch()) {
+      // the timer ran out while we were down; stay stopped
+      std::cerr << "sleep timer expired while not running" << std::endl;
+      ctx.sleep_deadline = 0;
+      save_sleep_deadline(ctx);
+      ctx.state->set("player.playing", "false");
+    }
+  }
+
+  if (saved_state(ctx, "player.playing", value)) {
+    bool playing = value == "true";
     if (playing) {
       std::cerr << "restoring playing state" << std::endl;
       play(ctx);
     }
   }
 
-  if (ctx.settings.contains("player.volume")) {
-    qreal vol = ctx.settings.value("player.volume").toReal();
+  // after play(), which would cancel a timer that is already fading
+  if (ctx.sleep_deadline != 0) {
+    std::cerr << "restoring sleep timer" << std::endl;
+    arm_sleep_timer(ctx);
+  }
+
+  if (!ctx.playing) {
+    suspend_when_silent(ctx);
+  }
+
+  if (saved_state(ctx, "player.volume", value)) {
+    double vol = std::strtod(value.c_str(), nullptr);
     ctx.noise.setVolume(vol);
   }
 
+  if (ctx.settings.contains("tone.bass") ||
+      ctx.settings.contains("tone.treble") ||
+      ctx.settings.contains("tone.lowpass")) {
+    tone_settings tone;
+    tone.bass_db = ctx.settings.value("tone.bass", 0).toInt();
+    tone.treble_db = ctx.settings.value("tone.treble", 0).toInt();
+    tone.lowpass_hz = ctx.settings.value("tone.lowpass", 0).toInt();
+    ctx.noise.setTone(tone);
+  }
+
   if (ctx.settings.contains("speaker.address")) {
     QBluetoothAddress speaker_addr(ctx.settings.value("speaker.address").toString());
     std::cerr << "restoring speaker device: "
@@ -137,14 +517,6 @@ void restore_state(app_context &ctx) {
   }
 }
 
-void stop(app_context &ctx) {
-  std::cerr << "stopping sound" << std::endl;
-  ctx.noise.quiet();
-  ctx.playing = false;
-  report_status(ctx);
-  save_state(ctx);
-}
-
 void vol_up(app_context &ctx) {
   std::cerr << "increasing volume by 3%" << std::endl;
   ctx.noise.setVolume(ctx.noise.volume() * 1.03);
@@ -167,6 +539,256 @@ void set_vol(app_context &ctx, int vol) {
   save_state(ctx);
 }
 
+void set_tone(app_context &ctx, const tone_settings &tone) {
+  std::cerr << "setting tone: bass "
+            << tone.bass_db
+            << " dB, treble "
+            << tone.treble_db
+            << " dB, low-pass "
+            << tone.lowpass_hz
+            << " Hz"
+            << std::endl;
+  ctx.noise.setTone(tone);
+  ctx.settings.setValue("tone.bass", tone.bass_db);
+  ctx.settings.setValue("tone.treble", tone.treble_db);
+  ctx.settings.setValue("tone.lowpass", tone.lowpass_hz);
+}
+
+void set_layer_gain(app_context &ctx, unsigned long index, int percent) {
+  std::cerr << "setting noise layer " << index << " to " << percent << "%" << std::endl;
+  ctx.mixer->setLayerGain(index, percent / 100.0);
+  ctx.settings.setValue("player.layer_gain." + QString::number(index), percent);
+}
+
+void log_audio_stats(app_context &ctx) {
+  std::cerr << "audio stats: " << format_audio_stats(ctx.noise.stats().snapshot()) << std::endl;
+
+  ring_fill_stats stats = ctx.noise.ringStats();
+
+  if (stats.capacity == 0) {
+    return;
+  }
+
+  std::cerr << "render ring fill: "
+            << stats.fill / noise_channels
+            << "/"
+            << stats.capacity / noise_channels
+            << " frames, low water: "
+            << stats.low_water / noise_channels
+            << " frames, underruns: "
+            << stats.underruns
+            << std::endl;
+}
+
+// builds the source the settings ask for: the player.layers mix if there is
+// one, player.source otherwise. `mixer`, if given, is pointed at the mixer.
+std::unique_ptr<noise_source> make_player_source(app_context &ctx, noise_mixer **mixer) {
+  auto crossfade_ms = ctx.settings.value("player.crossfade_ms", 0).toULongLong();
+  auto crossfade_frames = crossfade_ms * noise_sample_rate / 1000;
+
+  if (ctx.settings.contains("player.layers")) {
+    std::string layers = ctx.settings.value("player.layers").toString().toStdString();
+    std::cerr << "mixing noise layers: " << layers << std::endl;
+    auto mix = make_noise_mixer(layers, crossfade_frames);
+
+    // gains set with LAYER since take the place of the ones in the list
+    for (unsigned long i = 0; i < mix->layerCount(); i++) {
+      QString key = "player.layer_gain." + QString::number(i);
+      if (ctx.settings.contains(key)) {
+        mix->setLayerGain(i, ctx.settings.value(key).toInt() / 100.0);
+      }
+    }
+
+    if (mixer) {
+      *mixer = mix.get();
+    }
+    return std::unique_ptr<noise_source>(std::move(mix));
+  }
+
+  std::string source = ctx.settings.value("player.source", "file").toString().toStdString();
+  bool prescale = ctx.settings.value("player.prescale", false).toBool();
+  // the rate the file asset or stream was recorded at; generators always
+  // run at noise_sample_rate
+  auto source_rate = static_cast<unsigned long>(
+      ctx.settings.value("player.source_rate", static_cast<qulonglong>(noise_sample_rate)).toULongLong());
+  bool resample = source_rate != noise_sample_rate && source_rate > 0 && (source == "file" || source == "stream");
+  std::cerr << "using noise source: " << source << std::endl;
+
+  std::unique_ptr<noise_source> src;
+  if (source == "stream") {
+    // long recordings go wherever there is room for them
+    std::string path = ctx.settings.value("player.stream_path",
+                                          noise_asset_path("brown.raw").c_str()).toString().toStdString();
+    std::cerr << "streaming noise from " << path << std::endl;
+    src.reset(new streaming_file_source(path.c_str()));
+  } else {
+    src = make_noise_source(source, resample ? crossfade_ms * source_rate / 1000 : crossfade_frames,
+                            prescale && !resample);
+  }
+
+  if (resample) {
+    std::cerr << "resampling noise source from " << source_rate << " Hz" << std::endl;
+    src.reset(new resampled_source(std::move(src), source_rate, ctx.quality));
+  }
+  return src;
+}
+
+// the smallest power of two buffer that covers the slowest block render seen,
+// twice over, plus `margin_ms` for the pulling thread being held up
+unsigned long choose_buffer_frames(unsigned long worst_block_ns, unsigned long block_frames, unsigned long margin_ms) {
+  double seconds = 2 * worst_block_ns / 1e9 + margin_ms / 1000.0;
+  auto needed = static_cast<unsigned long>(seconds * noise_sample_rate) + block_frames;
+
+  unsigned long frames = min_buffer_frames;
+  while (frames < needed && frames < max_buffer_frames) {
+    frames <<= 1;
+  }
+  return frames;
+}
+
+unsigned long configured_block_frames(app_context &ctx) {
+  return std::max<unsigned long>(ctx.settings.value("audio.block_frames", 1024).toULongLong(), 64);
+}
+
+// the output buffer auto-tuning settles on: what the last measurement asked
+// for, but never below what underruns have pushed it to
+unsigned long autotuned_buffer_frames(app_context &ctx) {
+  return std::max(ctx.tuned_buffer_frames, ctx.tuned_floor_frames);
+}
+
+// starts measuring what rendering costs with the current settings, on a
+// thread of its own so that the event loop keeps serving Bluetooth and the
+// clients meanwhile. renders a second copy of the source, so playback does
+// not skip ahead. finish_autotune() picks up the result.
+void autotune_buffer(app_context &ctx) {
+  if (ctx.autotune_result.valid()) {
+    // finish_autotune() starts over if the settings changed meanwhile
+    return;
+  }
+
+  unsigned long block_frames = configured_block_frames(ctx);
+  auto scratch = ctx.noise.scratchRenderer(make_player_source(ctx, nullptr));
+
+  ctx.autotune_result = std::async(std::launch::async, [scratch = std::move(scratch), block_frames]() {
+    return render_cost{measure_render_cost(*scratch, block_frames, autotune_blocks), block_frames};
+  });
+  ctx.autotune_timer.start(autotune_poll_ms);
+}
+
+std::unique_ptr<audio_sink> make_audio_sink(app_context &ctx, QObject *parent) {
+  QString backend = ctx.settings.value("audio.backend", "qt").toString();
+  auto period_frames = static_cast<unsigned long>(ctx.settings.value("audio.period_frames", 0).toULongLong());
+
+  ctx.block_frames = configured_block_frames(ctx);
+  ctx.buffer_frames = static_cast<unsigned long>(ctx.settings.value("audio.buffer_frames", 0).toULongLong());
+  if (ctx.settings.value("audio.autotune", false).toBool()) {
+    ctx.buffer_frames = autotuned_buffer_frames(ctx);
+  }
+
+  std::unique_ptr<audio_sink> sink;
+
+  if (backend == "alsa") {
+#ifdef WHITENOISE_HAVE_ALSA
+    std::string pcm_name = ctx.settings.value("audio.alsa_device", "default").toString().toStdString();
+
+    std::cerr << "using alsa audio output: " << pcm_name << std::endl;
+    sink.reset(new alsa_sink(ctx.noise, pcm_name, 1024, 4096));
+#else
+    std::cerr << "alsa audio output not built in; using qt" << std::endl;
+#endif
+  }
+
+  if (!sink) {
+    // QAudioOutput pulls on the event loop, so render ahead on another thread.
+    // the ring has to hold at least what one pull may ask for.
+    if (ctx.settings.value("audio.render_thread", true).toBool()) {
+      auto ring_frames = static_cast<unsigned long>(ctx.settings.value("audio.ring_frames", 8192).toULongLong());
+      bool realtime = ctx.settings.value("audio.realtime", false).toBool();
+      ctx.noise.startRenderThread(std::max(ring_frames, 2 * ctx.buffer_frames), ctx.block_frames, realtime);
+    }
+
+    sink.reset(new qt_audio_sink(ctx.noise, parent));
+  }
+
+  sink->setBufferFrames(ctx.buffer_frames, period_frames);
+  return sink;
+}
+
+// rebuilds the audio output and the render thread with the current buffer
+// settings
+void restart_audio_output(app_context &ctx) {
+  std::cerr << "restarting audio output" << std::endl;
+
+  ctx.suspend_timer.stop();
+  ctx.sink->stop();
+  ctx.sink.reset();
+  ctx.noise.stopRenderThread();
+
+  ctx.sink = make_audio_sink(ctx, QCoreApplication::instance());
+  ctx.noise.stats().restartIntervals();
+  if (!ctx.sink->start()) {
+    std::cerr << "could not start " << ctx.sink->name() << " audio output" << std::endl;
+  }
+
+  ctx.suspended = false;
+  suspend_when_silent(ctx);
+}
+
+// sizes the output buffer from a finished measurement, restarting the output
+// if that changes it. does nothing while the measurement is still running.
+void finish_autotune(app_context &ctx) {
+  if (!ctx.autotune_result.valid()
+      || ctx.autotune_result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+    return;
+  }
+
+  ctx.autotune_timer.stop();
+  render_cost cost = ctx.autotune_result.get();
+  if (cost.block_frames != configured_block_frames(ctx)) {
+    autotune_buffer(ctx);
+    return;
+  }
+
+  auto margin_ms = static_cast<unsigned long>(ctx.settings.value("audio.autotune_margin_ms", 20).toULongLong());
+  ctx.tuned_buffer_frames = choose_buffer_frames(cost.worst_ns, cost.block_frames, margin_ms);
+
+  std::cerr << "auto-tune: slowest " << cost.block_frames << " frame block took " << cost.worst_ns / 1000
+            << " us; asking for an output buffer of " << ctx.tuned_buffer_frames << " frames" << std::endl;
+
+  if (ctx.sink && ctx.settings.value("audio.autotune", false).toBool()
+      && (autotuned_buffer_frames(ctx) != ctx.buffer_frames || cost.block_frames != ctx.block_frames)) {
+    restart_audio_output(ctx);
+  }
+}
+
+// with auto-tuning on, doubles the output buffer for good once the output
+// keeps underrunning. a single dropout, such as a Bluetooth hiccup, is not
+// enough.
+void check_buffer_underruns(app_context &ctx) {
+  audio_stats_snapshot stats = ctx.noise.stats().snapshot();
+  uint64_t underruns = stats.output_underruns + stats.render_underruns;
+  bool underran = underruns != ctx.tuned_underruns;
+
+  ctx.tuned_underruns = underruns;
+  ctx.underrun_history = ((ctx.underrun_history << 1) | (underran ? 1 : 0)) & ((1u << underrun_window) - 1);
+
+  if (!underran || !ctx.settings.value("audio.autotune", false).toBool() || ctx.buffer_frames >= max_buffer_frames) {
+    return;
+  }
+
+  auto recent = std::bitset<underrun_window>(ctx.underrun_history).count();
+  if (recent < underrun_intervals_to_grow) {
+    std::cerr << "auto-tune: output underran in " << recent << " of the last " << underrun_window
+              << " intervals; keeping the buffer" << std::endl;
+    return;
+  }
+  ctx.underrun_history = 0;
+
+  ctx.tuned_floor_frames = std::max(ctx.buffer_frames, min_buffer_frames) * 2;
+  std::cerr << "auto-tune: output underran; raising buffer to " << ctx.tuned_floor_frames << " frames" << std::endl;
+  restart_audio_output(ctx);
+}
+
 void bt_discover(app_context &ctx) {
   ctx.disco_agent.start();
 }
@@ -194,12 +816,14 @@ void bt_device_discovered(app_context &ctx, const QBluetoothDeviceInfo &device)
             << device.name().toStdString()
             << std::endl;
 
-  for (const auto &socket : ctx.client_sockets) {
-    socket->write("BT_DEVICE,");
-    socket->write(device.address().toString().replace(",", "_").toUtf8());
-    socket->write(",");
-    socket->write(device.name().replace(",", "_").toUtf8());
-    socket->write("\n");
+  QByteArray address = device.address().toString().replace(",", "_").toUtf8();
+  QByteArray line = "BT_DEVICE," + address + "," + device.name().replace(",", "_").toUtf8() + "\n";
+
+  // a device seen again replaces its line if that has not gone out yet
+  for (const auto &client : ctx.clients) {
+    client->queue.pushDevice(std::string_view(address.constData(), static_cast<unsigned long>(address.size())),
+                             std::string_view(line.constData(), static_cast<unsigned long>(line.size())));
+    flush_client(ctx, *client);
   }
 
   // attempt to auto connect if paired
@@ -277,56 +901,62 @@ void bt_unpair_speaker(app_context &ctx) {
   ctx.settings.remove("speaker.address");
 }
 
-void read_socket(app_context &ctx,
-                 QBluetoothSocket *socket) {
-  while (socket->canReadLine()) {
-    QByteArray line = socket->readLine().trimmed();
-    std::string recv_cmd(line.constData(), static_cast<unsigned long>(line.length()));
-    std::cerr << "read message from "
-              << socket->peerName().toStdString()
-              << ": "
-              << recv_cmd
-              << std::endl;
-
-    auto cmdv = parse_cmd(recv_cmd);
+using cmd_args = arg_span<std::string_view>;
 
-    for (unsigned long i = 0; i < cmdv.size(); i++) {
-      std::cerr << "cmdv["
-                << i
-                << "]: "
-                << cmdv[i]
-                << std::endl;
-    }
+// handlers get the arguments after the command name and return false if
+// those do not make sense
+using command_handler = bool (*)(app_context &ctx, client_connection &client, cmd_args args);
 
-    std::map<std::string, std::function<void()>> cmd_dispatch;
-
-    cmd_dispatch.emplace("PLAY", [&ctx]() {
-      play(ctx);
-    });
-
-    cmd_dispatch.emplace("STOP", [&ctx]() {
-      stop(ctx);
-    });
+// parses argument `i` if there is one; `value` keeps its default otherwise
+bool optional_int_arg(cmd_args args, std::size_t i, int &value) {
+  return i >= args.size() || parse_int(args[i], value);
+}
 
-    cmd_dispatch.emplace("VOL_UP", [&ctx]() {
-      vol_up(ctx);
-    });
+static constexpr command_entry<command_handler> commands[] = {
+    {"BUFFER", [](app_context &ctx, client_connection &client, cmd_args args) {
+      // BUFFER[,<buffer frames>|AUTO[,<block frames>]]; 0 buffer frames leaves
+      // the size to the backend. without arguments only reports the sizes.
+      // AUTO replies with the sizes in use until the measurement is done.
+      if (args.size() > 0) {
+        bool autotune = args[0] == "AUTO";
+        int buffer_frames = 0;
+        int block_frames = static_cast<int>(ctx.block_frames);
+
+        if ((!autotune && !parse_int(args[0], buffer_frames)) || !optional_int_arg(args, 1, block_frames)) {
+          return false;
+        }
 
-    cmd_dispatch.emplace("VOL_DOWN", [&ctx]() {
-      vol_down(ctx);
-    });
+        ctx.settings.setValue("audio.autotune", autotune);
+        if (!autotune) {
+          ctx.settings.setValue("audio.buffer_frames", std::min(std::max(buffer_frames, 0),
+                                                                static_cast<int>(max_buffer_frames)));
+        }
+        ctx.settings.setValue("audio.block_frames", std::min(std::max(block_frames, 64), 16384));
+
+        ctx.tuned_floor_frames = min_buffer_frames;
+        ctx.underrun_history = 0;
+        if (autotune) {
+          // restarts the output once measured, if that changes anything
+          autotune_buffer(ctx);
+        } else {
+          restart_audio_output(ctx);
+        }
+      }
 
-    cmd_dispatch.emplace("SET_VOL", [&ctx, &cmdv]() {
-      set_vol(ctx, std::stoi(cmdv[1]));
-    });
+      std::string reply = "BUFFER," + std::to_string(ctx.buffer_frames) + "," + std::to_string(ctx.block_frames)
+          + (ctx.settings.value("audio.autotune", false).toBool() ? ",AUTO" : ",FIXED") + "\n";
+      send_reply(ctx, client, reply);
+      return true;
+    }},
 
-    cmd_dispatch.emplace("SCAN", [&ctx]() {
-      bt_discover(ctx);
-    });
+    {"CONNECT", [](app_context &ctx, client_connection &, cmd_args args) {
+      if (args.size() < 1) {
+        return false;
+      }
 
-    cmd_dispatch.emplace("CONNECT", [&ctx, &cmdv]() {
-      ctx.speaker_device = QBluetoothAddress(QString::fromStdString(cmdv[1]));
-      ctx.settings.setValue("speaker.address", QString::fromStdString(cmdv[1]));
+      QString address = QString::fromUtf8(args[0].data(), static_cast<int>(args[0].size()));
+      ctx.speaker_device = QBluetoothAddress(address);
+      ctx.settings.setValue("speaker.address", address);
       ctx.connected_speaker = false;
 
       for (const QBluetoothAddress &connected_addr : ctx.local_device.connectedDevices()) {
@@ -340,22 +970,157 @@ void read_socket(app_context &ctx,
       }
 
       if (!ctx.connected_speaker) {
-        bt_pair_or_connect(ctx, QBluetoothAddress(QString::fromStdString(cmdv[1])));
+        bt_pair_or_connect(ctx, QBluetoothAddress(address));
+      }
+      return true;
+    }},
+
+    {"LAYER", [](app_context &ctx, client_connection &, cmd_args args) {
+      // LAYER,<index>,<gain %>; the layers are the ones in player.layers
+      int index = 0;
+      int percent = 0;
+      if (!ctx.mixer || args.size() < 2 || !parse_int(args[0], index) || !parse_int(args[1], percent) ||
+          index < 0 || static_cast<unsigned long>(index) >= ctx.mixer->layerCount()) {
+        return false;
+      }
+      set_layer_gain(ctx, static_cast<unsigned long>(index), std::min(std::max(percent, 0), 400));
+      return true;
+    }},
+
+    {"PLAY", [](app_context &ctx, client_connection &, cmd_args) {
+      play(ctx);
+      return true;
+    }},
+
+    {"SCAN", [](app_context &ctx, client_connection &, cmd_args) {
+      bt_discover(ctx);
+      return true;
+    }},
+
+    {"SET_VOL", [](app_context &ctx, client_connection &, cmd_args args) {
+      int vol = 0;
+      if (args.size() < 1 || !parse_int(args[0], vol)) {
+        return false;
+      }
+      set_vol(ctx, vol);
+      return true;
+    }},
+
+    {"STATS", [](app_context &ctx, client_connection &client, cmd_args) {
+      // STATS; answers only the client that asked
+      std::string stats = "STATS," + format_audio_stats(ctx.noise.stats().snapshot()) + "\n";
+      send_reply(ctx, client, stats);
+      return true;
+    }},
+
+    {"STOP", [](app_context &ctx, client_connection &, cmd_args) {
+      stop(ctx);
+      return true;
+    }},
+
+    {"TIMER", [](app_context &ctx, client_connection &, cmd_args args) {
+      // TIMER,<minutes>[,<fade seconds>[,<curve>]]; 0 minutes cancels
+      int minutes = 0;
+      int fade_s = -1;
+      if (!optional_int_arg(args, 0, minutes) || !optional_int_arg(args, 1, fade_s)) {
+        return false;
+      }
+
+      if (args.size() > 1) {
+        ctx.settings.setValue("timer.fade_s", std::max(fade_s, 0));
+      }
+
+      fade_curve curve;
+      if (args.size() > 2 && parse_fade_curve(args[2], curve)) {
+        ctx.settings.setValue("timer.curve", fade_curve_name(curve));
       }
-    });
 
-    cmd_dispatch.emplace("UNPAIR_SPEAKER", [&ctx]() {
+      set_sleep_timer(ctx, minutes);
+      return true;
+    }},
+
+    {"TONE", [](app_context &ctx, client_connection &, cmd_args args) {
+      // TONE,<bass dB>,<treble dB>[,<low-pass Hz>]
+      tone_settings tone;
+      if (!optional_int_arg(args, 0, tone.bass_db) ||
+          !optional_int_arg(args, 1, tone.treble_db) ||
+          !optional_int_arg(args, 2, tone.lowpass_hz)) {
+        return false;
+      }
+      set_tone(ctx, tone);
+      return true;
+    }},
+
+    {"UNPAIR_SPEAKER", [](app_context &ctx, client_connection &, cmd_args) {
       bt_unpair_speaker(ctx);
-    });
+      return true;
+    }},
+
+    {"VOL_DOWN", [](app_context &ctx, client_connection &, cmd_args) {
+      vol_down(ctx);
+      return true;
+    }},
 
-    auto cmd_it = cmd_dispatch.find(cmdv[0]);
+    {"VOL_UP", [](app_context &ctx, client_connection &, cmd_args) {
+      vol_up(ctx);
+      return true;
+    }},
+};
+
+static_assert(commands_sorted(commands), "commands must be sorted by name");
+
+void handle_line(app_context &ctx, client_connection &client, std::string_view line) {
+  std::cerr << "read message from "
+            << client.socket->peerName().toStdString()
+            << ": "
+            << line
+            << std::endl;
+
+  std::string_view fields[max_command_fields];
+  std::size_t count = split_command(line, fields);
+  const auto *cmd = find_command(commands, fields[0]);
+
+  if (cmd && cmd->handler(ctx, client, cmd_args(fields + 1, count - 1))) {
+    send_reply(ctx, client, "OK\n");
+  } else {
+    send_reply(ctx, client, "ERR\n");
+  }
+}
 
-    if (cmd_it != cmd_dispatch.end()) {
-      cmd_dispatch[cmd_it->first]();
-      socket->write("OK\n");
-    } else {
-      socket->write("ERR\n");
+// appends whatever has arrived to the client's buffer and handles every
+// complete line in place, without copying it out
+void read_socket(app_context &ctx,
+                 client_connection &client) {
+  QBluetoothSocket *socket = client.socket;
+
+  auto old_size = client.received.size();
+  auto available = static_cast<unsigned long>(std::max<qint64>(socket->bytesAvailable(), 0));
+  client.received.resize(old_size + available);
+  qint64 got = socket->read(&client.received[old_size], static_cast<qint64>(available));
+  client.received.resize(old_size + static_cast<unsigned long>(std::max<qint64>(got, 0)));
+
+  std::string_view pending(client.received);
+  if (client.discarding) {
+    auto newline = pending.find('\n');
+    if (newline == std::string_view::npos) {
+      client.received.clear();
+      return;
     }
+    pending.remove_prefix(newline + 1);
+    client.discarding = false;
+  }
+
+  for (auto newline = pending.find('\n'); newline != std::string_view::npos; newline = pending.find('\n')) {
+    handle_line(ctx, client, trim_field(pending.substr(0, newline)));
+    pending.remove_prefix(newline + 1);
+  }
+  client.received.erase(0, client.received.size() - pending.size());
+
+  if (client.received.size() > max_line_bytes) {
+    std::cerr << "dropping overlong line from " << socket->peerName().toStdString() << std::endl;
+    client.received.clear();
+    client.discarding = true;
+    send_reply(ctx, client, "ERR\n");
   }
 }
 
@@ -370,14 +1135,25 @@ void client_connected(QBluetoothServer &rfcomm_server,
   QObject::connect(socket,
                    &QBluetoothSocket::readyRead,
                    [&ctx, socket]() {
-                     read_socket(ctx, socket);
+                     client_connection *client = find_client(ctx, socket);
+                     if (client) {
+                       read_socket(ctx, *client);
+                     }
                    });
   QObject::connect(socket,
                    &QBluetoothSocket::disconnected,
                    [&ctx, socket]() {
                      client_disconnected(ctx, socket);
                    });
-  ctx.client_sockets.push_back(socket);
+  QObject::connect(socket,
+                   &QBluetoothSocket::bytesWritten,
+                   [&ctx, socket](qint64) {
+                     client_connection *client = find_client(ctx, socket);
+                     if (client) {
+                       flush_client(ctx, *client);
+                     }
+                   });
+  ctx.clients.emplace_back(new client_connection{socket});
 
   std::cerr << "client connected: " << socket->peerName().toStdString() << std::endl;
 
@@ -391,22 +1167,50 @@ int main(int argc, char *argv[]) {
 
   app_context ctx = {};
 
-  QAudioFormat fmt;
+  // next to the settings file, but written on its own schedule
+  QString state_dir = QFileInfo(ctx.settings.fileName()).absolutePath();
+  QString state_path = state_dir + "/whitenoise-state";
+  // QSettings only creates its directory once it writes, which may be never
+  if (!QDir().mkpath(state_dir)) {
+    std::cerr << "could not create " << state_dir.toStdString() << std::endl;
+  }
+  auto save_delay_ms = ctx.settings.value("player.save_delay_ms", 1000).toLongLong();
+  ctx.state.reset(new state_store(state_path.toStdString(), std::chrono::milliseconds(save_delay_ms)));
+  std::cerr << "keeping player state in " << state_path.toStdString() << std::endl;
 
-  fmt.setSampleRate(44100);
-  fmt.setChannelCount(2);
-  fmt.setSampleSize(16);
-  fmt.setCodec("audio/pcm");
-  fmt.setByteOrder(QAudioFormat::LittleEndian);
-  fmt.setSampleType(QAudioFormat::UnSignedInt);
-  QAudioOutput player(fmt, &a);
+  if (ctx.settings.value("player.gain_mode").toString() == "float") {
+    std::cerr << "using floating point gain" << std::endl;
+    ctx.noise.setGainMode(gain_mode::floating);
+  }
+
+  resample_quality quality = resample_quality::medium;
+  std::string quality_name = ctx.settings.value("audio.resample_quality", "medium").toString().toStdString();
+  if (!parse_resample_quality(quality_name, quality)) {
+    std::cerr << "unknown resample quality " << quality_name << "; using medium" << std::endl;
+  }
+  ctx.noise.setResampleQuality(quality);
+  ctx.quality = quality;
+
+  ctx.noise.setSource(make_player_source(ctx, &ctx.mixer));
+
+  QObject::connect(&ctx.autotune_timer,
+                   &QTimer::timeout,
+                   [&ctx]() {
+                     finish_autotune(ctx);
+                   });
+  if (ctx.settings.value("audio.autotune", false).toBool()) {
+    // nothing is waiting on the event loop yet, so startup may wait for the
+    // first measurement instead of restarting the output once it is done
+    autotune_buffer(ctx);
+    ctx.autotune_result.wait();
+    finish_autotune(ctx);
+  }
 
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wreturn-stack-address"
-  ctx.player = &player;
-#pragma clang diagnostic pop
+  ctx.sink = make_audio_sink(ctx, &a);
 
-  ctx.player->start(&ctx.noise);
+  if (!ctx.sink->start()) {
+    std::cerr << "could not start " << ctx.sink->name() << " audio output" << std::endl;
+  }
 
   QObject::connect(&ctx.disco_agent,
                    &QBluetoothDeviceDiscoveryAgent::deviceDiscovered,
@@ -515,6 +1319,30 @@ int main(int argc, char *argv[]) {
                      job->deleteLater();
                    });
 
+  QObject::connect(&ctx.sleep_fade_timer,
+                   &QTimer::timeout,
+                   [&ctx]() {
+                     auto fade_s = std::min<qulonglong>(ctx.settings.value("timer.fade_s", 60).toULongLong(),
+                                                        max_sleep_ms / 1000);
+                     start_sleep_fade(ctx, fade_s);
+                   });
+  ctx.sleep_fade_timer.setSingleShot(true);
+
+  QObject::connect(&ctx.sleep_timer,
+                   &QTimer::timeout,
+                   [&ctx]() {
+                     sleep_timer_expired(ctx);
+                   });
+  ctx.sleep_timer.setSingleShot(true);
+
+  QObject::connect(&ctx.suspend_timer,
+                   &QTimer::timeout,
+                   [&ctx]() {
+                     suspend_when_silent(ctx);
+                   });
+  ctx.suspend_timer.setSingleShot(true);
+  ctx.suspend_timer.setInterval(250);
+
   restore_state(ctx);
 
   QObject::connect(&ctx.scan_timer,
@@ -534,12 +1362,21 @@ int main(int argc, char *argv[]) {
   ctx.advertise_timer.setInterval(30000);
   ctx.advertise_timer.start();
 
+  QObject::connect(&ctx.stats_timer,
+                   &QTimer::timeout,
+                   [&ctx]() {
+                     log_audio_stats(ctx);
+                     check_buffer_underruns(ctx);
+                   });
+  ctx.stats_timer.setInterval(60000);
+  ctx.stats_timer.start();
+
   auto result = QCoreApplication::exec();
 
   service_info.unregisterService();
 
-  for (QBluetoothSocket *socket : ctx.client_sockets) {
-    delete socket;
+  for (const auto &client : ctx.clients) {
+    delete client->socket;
   }
 
   return result;
@@ -0,0 +1,128 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "ima_adpcm.h"
+
+// converts a raw s16 stereo asset such as brown.raw to the ADPCM format
+// played by the "adpcm" source, then decodes the result again to report
+// its quality and what decoding costs.
+
+void usage() {
+  std::cerr << "usage: noise-adpcm-encode IN.raw OUT.adpcm [--rate HZ] [--block-frames N]" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    usage();
+    return 1;
+  }
+
+  unsigned long rate = noise_sample_rate;
+  unsigned long block_frames = adpcm_default_block_frames;
+
+  for (int i = 3; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--rate" && has_value) {
+      rate = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--block-frames" && has_value) {
+      block_frames = std::max(std::strtoul(argv[++i], nullptr, 10), 2ul);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  std::ifstream in(argv[1], std::ios::binary);
+  std::vector<char> raw((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  unsigned long frames = raw.size() / 2 / noise_channels;
+
+  if (frames == 0) {
+    std::cerr << "no audio in " << argv[1] << std::endl;
+    return 1;
+  }
+
+  std::vector<int16_t> pcm(frames * noise_channels);
+  std::memcpy(pcm.data(), raw.data(), pcm.size() * 2);
+
+  unsigned long block_bytes = adpcm_block_bytes(block_frames);
+  unsigned long block_count = (frames + block_frames - 1) / block_frames;
+  std::vector<uint8_t> encoded(adpcm_header_bytes + block_count * block_bytes);
+
+  adpcm_write_header({noise_channels, rate, block_frames, frames}, encoded.data());
+
+  adpcm_channel state[2];
+  for (unsigned long b = 0; b < block_count; b++) {
+    unsigned long first = b * block_frames;
+    adpcm_encode_block(pcm.data() + first * noise_channels,
+                       std::min(block_frames, frames - first),
+                       block_frames,
+                       state,
+                       encoded.data() + adpcm_header_bytes + b * block_bytes);
+  }
+
+  std::ofstream out(argv[2], std::ios::binary);
+  out.write(reinterpret_cast<const char *>(encoded.data()), static_cast<std::streamsize>(encoded.size()));
+  if (!out) {
+    std::cerr << "could not write " << argv[2] << std::endl;
+    return 1;
+  }
+  out.close();
+
+  std::cout << "encoded " << frames << " frames: " << raw.size() << " -> " << encoded.size()
+            << " bytes" << std::endl;
+
+  // decode through the same source the player uses
+  adpcm_loop_source source(argv[2]);
+  if (!source.valid()) {
+    return 1;
+  }
+
+  std::vector<int16_t> decoded(pcm.size());
+  std::vector<int16_t> scratch(block_frames * noise_channels);
+  unsigned long total = 0;
+  auto start = std::chrono::steady_clock::now();
+  double elapsed = 0;
+  int laps = 0;
+
+  // at least a second's worth of decoding for a stable figure
+  while (elapsed < 1 || laps == 0) {
+    unsigned long done = 0;
+    while (done < decoded.size()) {
+      unsigned long n = std::min(decoded.size() - done, scratch.size());
+      const int16_t *p = source.pull(scratch.data(), n);
+      if (laps == 0) {
+        std::memcpy(decoded.data() + done, p, n * 2);
+      }
+      done += n;
+    }
+
+    total += done;
+    laps++;
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  double noise = 0;
+  double signal = 0;
+  for (unsigned long i = 0; i < pcm.size(); i++) {
+    double d = static_cast<double>(decoded[i]) - pcm[i];
+    noise += d * d;
+    signal += static_cast<double>(pcm[i]) * pcm[i];
+  }
+
+  double ns_per_sample = elapsed * 1e9 / static_cast<double>(total);
+  double core_share = ns_per_sample * noise_channels * rate / 1e9 * 100;
+
+  std::cout << std::fixed << std::setprecision(2)
+            << "snr: " << 10 * std::log10(signal / std::max(noise, 1.0)) << " dB" << std::endl
+            << "decode: " << ns_per_sample << " ns/sample, "
+            << std::setprecision(3) << core_share << "% of one core at " << rate << " Hz stereo" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,147 @@
+#ifndef WHITENOISE_BT_CONTROLLER_NOISE_ASSET_H
+#define WHITENOISE_BT_CONTROLLER_NOISE_ASSET_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// where to find an asset that comes with the program: the working directory,
+// as always, or else where the build installs it
+inline std::string noise_asset_path(const char *name) {
+#ifdef WHITENOISE_ASSET_DIR
+  if (::access(name, R_OK) != 0) {
+    return std::string(WHITENOISE_ASSET_DIR "/") + name;
+  }
+#endif
+  return name;
+}
+
+// read-only view of a raw PCM noise file. the file is memory-mapped when
+// possible so it is shared through the page cache with other processes
+// playing the same asset; otherwise it is read into a heap buffer.
+class noise_asset {
+ public:
+  noise_asset() = default;
+
+  noise_asset(const noise_asset &) = delete;
+  noise_asset &operator=(const noise_asset &) = delete;
+
+  ~noise_asset() {
+    release();
+  }
+
+  bool load(const char *path) {
+    release();
+
+    if (map_file(path)) {
+      std::cerr << "mapped noise buffer file of length: " << data_len << std::endl;
+      return true;
+    }
+
+    if (read_file(path)) {
+      std::cerr << "read noise buffer file of length: " << data_len << std::endl;
+      return true;
+    }
+
+    return false;
+  }
+
+  const char *data() const {
+    return data_ptr;
+  }
+
+  unsigned long size() const {
+    return data_len;
+  }
+
+  bool mapped() const {
+    return mapping != nullptr;
+  }
+
+ private:
+  bool map_file(const char *path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat st = {};
+
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+      ::close(fd);
+      return false;
+    }
+
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+#endif
+
+    void *addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, flags, fd, 0);
+    ::close(fd);
+
+    if (addr == MAP_FAILED) {
+      std::cerr << "could not map noise buffer; falling back to read" << std::endl;
+      return false;
+    }
+
+    madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+    mapping = addr;
+    data_len = static_cast<unsigned long>(st.st_size);
+    data_ptr = static_cast<const char *>(addr);
+    return true;
+  }
+
+  bool read_file(const char *path) {
+    std::ifstream noise_if(path, std::ios::binary);
+
+    if (!noise_if) {
+      std::cerr << "could not open noise buffer" << std::endl;
+      return false;
+    }
+
+    noise_if.seekg(0, std::istream::end);
+    auto len = static_cast<unsigned long>(noise_if.tellg());
+    noise_if.seekg(0, std::istream::beg);
+
+    buffer.resize(len);
+    noise_if.read(buffer.data(), len);
+
+    if (!noise_if) {
+      std::cerr << "failed to read noise buffer" << std::endl;
+      buffer.clear();
+      return false;
+    }
+
+    data_len = len;
+    data_ptr = buffer.data();
+    return true;
+  }
+
+  void release() {
+    if (mapping) {
+      munmap(mapping, data_len);
+      mapping = nullptr;
+    }
+
+    buffer.clear();
+    buffer.shrink_to_fit();
+    data_ptr = nullptr;
+    data_len = 0;
+  }
+
+  void *mapping = nullptr;
+  std::vector<char> buffer;
+  const char *data_ptr = nullptr;
+  unsigned long data_len = 0;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_NOISE_ASSET_H
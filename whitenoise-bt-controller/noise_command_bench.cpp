@@ -0,0 +1,135 @@
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "command_table.h"
+
+// measures how many protocol messages per second the parse and dispatch
+// step of read_socket() gets through, with the same command names and
+// argument parsing but handlers that only count, and no socket. compares the
+// string_view tokenizer and static command table with copying every field
+// into a std::vector<std::string> and building a std::map of std::function
+// per message, as read_socket() used to.
+
+struct bench_context {
+  unsigned long calls = 0;
+  long sum = 0;
+};
+
+using bench_args = arg_span<std::string_view>;
+using bench_handler = bool (*)(bench_context &ctx, bench_args args);
+
+bool count_call(bench_context &ctx, bench_args) {
+  ctx.calls++;
+  return true;
+}
+
+bool count_args(bench_context &ctx, bench_args args) {
+  ctx.calls++;
+  for (std::size_t i = 0; i < args.size(); i++) {
+    int value = 0;
+    if (parse_int(args[i], value)) {
+      ctx.sum += value;
+    }
+  }
+  return true;
+}
+
+static constexpr command_entry<bench_handler> bench_commands[] = {
+    {"BUFFER", count_args},
+    {"CONNECT", count_call},
+    {"LAYER", count_args},
+    {"PLAY", count_call},
+    {"SCAN", count_call},
+    {"SET_VOL", count_args},
+    {"STATS", count_call},
+    {"STOP", count_call},
+    {"TIMER", count_args},
+    {"TONE", count_args},
+    {"UNPAIR_SPEAKER", count_call},
+    {"VOL_DOWN", count_call},
+    {"VOL_UP", count_call},
+};
+
+static_assert(commands_sorted(bench_commands), "commands must be sorted by name");
+
+bool dispatch_table(bench_context &ctx, const std::string &line) {
+  std::string_view fields[max_command_fields];
+  std::size_t count = split_command(line, fields);
+  const auto *cmd = find_command(bench_commands, fields[0]);
+  return cmd && cmd->handler(ctx, bench_args(fields + 1, count - 1));
+}
+
+// how read_socket() used to split lines
+std::vector<std::string> copy_fields(const std::string &cmd) {
+  std::vector<std::string> cmdv;
+  unsigned long start = 0U;
+  unsigned long end = cmd.find(',');
+
+  while (end != std::string::npos) {
+    cmdv.emplace_back(cmd.substr(start, end - start));
+    start = end + 1;
+    end = cmd.find(',', start);
+  }
+  cmdv.emplace_back(cmd.substr(start, end));
+  return cmdv;
+}
+
+bool dispatch_map(bench_context &ctx, const std::string &line) {
+  auto cmdv = copy_fields(line);
+  std::map<std::string, std::function<void()>> cmd_dispatch;
+
+  for (const auto &c : bench_commands) {
+    bool has_args = c.handler == count_args;
+    cmd_dispatch.emplace(std::string(c.name), [&ctx, &cmdv, has_args]() {
+      ctx.calls++;
+      for (unsigned long i = 1; has_args && i < cmdv.size(); i++) {
+        ctx.sum += std::atoi(cmdv[i].c_str());
+      }
+    });
+  }
+
+  auto cmd_it = cmd_dispatch.find(cmdv[0]);
+  if (cmd_it == cmd_dispatch.end()) {
+    return false;
+  }
+  cmd_dispatch[cmd_it->first]();
+  return true;
+}
+
+template<typename Dispatch>
+double messages_per_second(const std::vector<std::string> &lines, unsigned long count, Dispatch &&dispatch) {
+  bench_context ctx;
+  auto start = std::chrono::steady_clock::now();
+
+  for (unsigned long i = 0; i < count; i++) {
+    dispatch(ctx, lines[i % lines.size()]);
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (ctx.calls == 0) {
+    std::cerr << "nothing was dispatched" << std::endl;
+  }
+  return count / seconds;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+
+  // roughly what a phone app sends: mostly volume steps
+  std::vector<std::string> lines = {"VOL_UP", "VOL_UP", "VOL_DOWN", "SET_VOL,40", "PLAY",
+                                    "STOP", "TONE,3,-2,8000", "TIMER,30,60,cosine", "STATS", "NOPE"};
+
+  std::cout << count << " messages, " << lines.size() << " message mix" << std::endl;
+  std::cout << std::fixed << std::setprecision(0)
+            << std::setw(24) << "copies and map: " << messages_per_second(lines, count, dispatch_map) << " msg/s"
+            << std::endl
+            << std::setw(24) << "views and table: " << messages_per_second(lines, count, dispatch_table) << " msg/s"
+            << std::endl;
+  return 0;
+}
@@ -3,37 +3,39 @@
 
 #include <QIODevice>
 #include <iostream>
-#include <fstream>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "audio_stats.h"
+#include "gain_ramp.h"
+#include "noise_renderer.h"
+#include "render_thread.h"
+#include "resampler.h"
+#include "sample_format.h"
+#include "spsc_ring.h"
+
+struct ring_fill_stats {
+  unsigned long capacity;
+  unsigned long fill;
+  unsigned long low_water;
+  uint64_t underruns;
+};
 
 class noise_device : public QIODevice {
  public:
 
   noise_device() {
-    noise_data_len = 0;
-
-    // read noise data into buffer
-    std::ifstream noise_if("brown.raw", std::ios::binary);
-
-    if (!noise_if) {
-      std::cerr << "could not open noise buffer" << std::endl;
-    } else {
-      noise_if.seekg(0, std::istream::end);
-      noise_data_len = static_cast<unsigned long>(noise_if.tellg());
-      noise_if.seekg(0, std::istream::beg);
-
-      std::cerr << "opened noise buffer file of length: " << noise_data_len << std::endl;
-
-      noise_buffer.resize(noise_data_len);
-      noise_if.read(noise_buffer.data(), noise_data_len);
+    std::cerr << "using " << gain_kernel_name() << " gain kernel" << std::endl;
+    open(QIODevice::ReadOnly);
+  }
 
-      if (noise_if) {
-        std::cerr << "read noise buffer" << std::endl;
-        open(QIODevice::ReadOnly);
-      } else {
-        std::cerr << "failed to read noise buffer" << std::endl;
-      }
+  ~noise_device() override {
+    if (renderer_thread) {
+      renderer_thread->stop();
     }
   }
 
@@ -52,9 +54,167 @@ class noise_device : public QIODevice {
     QIODevice::close();
   }
 
+  // moves rendering off the thread that calls readData(). must be called
+  // before the device is handed to an audio output.
+  void startRenderThread(unsigned long ring_frames, unsigned long block_frames, bool realtime) {
+    if (renderer_thread) {
+      return;
+    }
+
+    ring.reset(new spsc_ring<int16_t>(ring_frames * noise_channels));
+    ring_low_water.store(ring->capacity());
+    renderer_thread.reset(new render_thread(renderer, *ring, block_frames));
+
+    std::cerr << "starting render thread with ring of "
+              << ring->capacity() / noise_channels
+              << " frames"
+              << (realtime ? " (realtime)" : "")
+              << std::endl;
+    renderer_thread->start(realtime);
+  }
+
+  // goes back to rendering in readData(), e.g. to start over with another
+  // ring or block size. the audio output must be stopped first.
+  void stopRenderThread() {
+    if (!renderer_thread) {
+      return;
+    }
+
+    renderer_thread->stop();
+    renderer_thread.reset();
+    ring.reset();
+  }
+
+  // a renderer of its own fed from `source`, with the current volume, gain
+  // mode and tone, for measure_render_cost(). what is playing does not move
+  // on and may keep playing meanwhile. `source` should be a fresh one like
+  // the playing source. the renderer may then be used on any one thread.
+  std::unique_ptr<noise_renderer> scratchRenderer(std::unique_ptr<noise_source> source) {
+    std::unique_ptr<noise_renderer> scratch(new noise_renderer());
+    scratch->setSource(std::move(source));
+    scratch->setGainMode(active_gain_mode);
+    scratch->setTone(active_tone);
+    scratch->setTargetVolume(set_volume);
+    return scratch;
+  }
+
+  // ring occupancy in samples; low_water is the lowest fill seen by readData()
+  // since the last call
+  ring_fill_stats ringStats() {
+    if (!ring) {
+      return {0, 0, 0, 0};
+    }
+
+    return {ring->capacity(),
+            ring->readable(),
+            ring_low_water.exchange(ring->capacity()),
+            audio.renderUnderruns()};
+  }
+
+  // how the audio output has been fed so far. the output's state changes are
+  // recorded here too, by whichever sink watches them.
+  audio_stats &stats() {
+    return audio;
+  }
+
+  // applies to the resampler created by the next setOutputFormat()
+  void setResampleQuality(resample_quality quality) {
+    output_quality = quality;
+  }
+
+  // sets what readData() and pullFrames() produce. like startRenderThread(),
+  // must be called before the device is handed to an audio output.
+  void setOutputFormat(const sample_format &fmt) {
+    output_format = fmt;
+    output_resampler.reset();
+
+    if (output_format.rate != noise_sample_rate) {
+      output_resampler.reset(new polyphase_resampler(noise_sample_rate, output_format.rate, output_quality));
+    }
+
+    std::cerr << "output format: " << output_format.name() << ", "
+              << output_format.channels << " channel(s), "
+              << output_format.rate << " Hz";
+    if (output_resampler) {
+      std::cerr << " (resampled, " << output_resampler->tapCount() << " taps)";
+    }
+    std::cerr << std::endl;
+  }
+
+  const sample_format &outputFormat() const {
+    return output_format;
+  }
+
+  // the setters below are called from the control thread and may run
+  // concurrently with readData()
+
   void setVolume(double vol) {
     set_volume = vol;
-    target_volume = set_volume;
+    renderer.setTargetVolume(set_volume);
+  }
+
+  void setSource(std::unique_ptr<noise_source> src) {
+    renderer.setSource(std::move(src));
+  }
+
+  void setGainMode(gain_mode mode) {
+    active_gain_mode = mode;
+    renderer.setGainMode(mode);
+  }
+
+  void setTone(const tone_settings &tone) {
+    active_tone = tone;
+    renderer.setTone(tone);
+  }
+
+  // fades the output out over `seconds`, on top of the volume; the gain stays
+  // at zero afterwards until cancelFade()
+  void startFade(unsigned long seconds, fade_curve curve) {
+    renderer.setFade(std::max(seconds * noise_sample_rate, 1ul), curve);
+  }
+
+  // brings the output up from silence over `ms` instead of the plain
+  // volume ramp
+  void fadeIn(unsigned long ms, fade_curve curve) {
+    renderer.setFade(std::max(ms * noise_sample_rate / 1000, 1ul), curve, true);
+  }
+
+  void cancelFade() {
+    renderer.setFade(0, fade_curve::cosine);
+  }
+
+  // true once the volume ramp (and any fade) has reached its target
+  bool settled() const {
+    return renderer.settled();
+  }
+
+  // how many frames the audio output itself buffers once started, at the
+  // output rate. called by the audio output once it knows.
+  void setOutputBufferFrames(unsigned long frames) {
+    output_buffer_frames = frames;
+  }
+
+  // true once everything still queued, in the ring and in the audio output's
+  // own buffer, is silence
+  bool silent() const {
+    uint64_t queued = ring ? ring->capacity() : 0;
+    queued += static_cast<uint64_t>(output_buffer_frames) * noise_channels * noise_sample_rate / output_format.rate;
+    return renderer.silentSamples() > queued;
+  }
+
+  // parks the render thread, if any, once the ring is full. the audio output
+  // has to be suspended separately.
+  void suspend() {
+    if (renderer_thread) {
+      renderer_thread->pause();
+    }
+  }
+
+  void resume() {
+    audio.restartIntervals();
+    if (renderer_thread) {
+      renderer_thread->resume();
+    }
   }
 
   double volume() {
@@ -62,44 +222,100 @@ class noise_device : public QIODevice {
   }
 
   void quiet() {
-    target_volume = 0;
+    renderer.setTargetVolume(0);
   }
 
   void unquiet() {
-    target_volume = set_volume;
+    renderer.setTargetVolume(set_volume);
   }
 
- protected:
-  qint64 readData(char *data, qint64 maxlen) override {
-    auto len_to_read = std::min(static_cast<unsigned long>(maxlen), noise_data_len - pos);
+  // fills `samples` samples (a multiple of noise_channels) from the render
+  // ring, or renders them in place when there is no render thread. called by
+  // whichever audio output drives the device.
+  void pull(int16_t *out, unsigned long samples) {
+    if (!ring) {
+      renderer.render(out, samples);
+      return;
+    }
 
-    for (unsigned long i = 0; i < len_to_read / 2; i++) {
-      int16_t val = *(reinterpret_cast<int16_t *>(noise_buffer.data() + pos + i * 2));
-      val = static_cast<int16_t>(val * cur_volume);
+    unsigned long copied = ring->read(out, samples);
 
-      if (cur_volume < target_volume) {
-        cur_volume += .000002;
-      } else if (cur_volume > target_volume) {
-        cur_volume -= .000002;
-      }
+    if (copied < samples) {
+      // the render thread fell behind; play silence rather than stall
+      std::fill(out + copied, out + samples, 0);
+      audio.recordRenderUnderrun();
+    }
 
-      std::memcpy(data + i * 2, &val, 2);
+    unsigned long fill = ring->readable();
+    if (fill < ring_low_water.load(std::memory_order_relaxed)) {
+      ring_low_water.store(fill, std::memory_order_relaxed);
     }
-    pos += len_to_read;
-    pos = pos % noise_data_len;
-    return static_cast<qint64>(len_to_read);
+  }
+
+  // like pull(), but fills `frames` frames in the output format
+  void pullFrames(char *out, unsigned long frames) {
+    auto start = audio_stats::clock::now();
+    convertFrames(out, frames);
+    unsigned long bytes = frames * output_format.bytesPerFrame();
+    audio.recordPull(bytes, bytes, start, audio_stats::clock::now());
+  }
+
+ protected:
+  qint64 readData(char *data, qint64 maxlen) override {
+    auto start = audio_stats::clock::now();
+    unsigned long frames = static_cast<unsigned long>(maxlen) / output_format.bytesPerFrame();
+    convertFrames(data, frames);
+
+    unsigned long delivered = frames * output_format.bytesPerFrame();
+    audio.recordPull(static_cast<unsigned long>(maxlen), delivered, start, audio_stats::clock::now());
+    return static_cast<qint64>(delivered);
   }
   qint64 writeData(const char *data, qint64 len) override {
     return -1;
   }
 
  private:
-  unsigned long pos = 0;
-  unsigned long noise_data_len;
-  std::vector<char> noise_buffer;
+  static constexpr unsigned long convert_frames = 1024;
+
+  void convertFrames(char *out, unsigned long frames) {
+    if (output_format.native()) {
+      pull(reinterpret_cast<int16_t *>(out), frames * noise_channels);
+      return;
+    }
+
+    while (frames > 0) {
+      unsigned long n = std::min(frames, convert_frames);
+
+      if (output_resampler) {
+        output_resampler->render(convert_scratch, n, [this](int16_t *in, unsigned long in_frames) {
+          pull(in, in_frames * noise_channels);
+        });
+      } else {
+        pull(convert_scratch, n * noise_channels);
+      }
+
+      convert_samples(convert_scratch, n, output_format, out);
+      out += n * output_format.bytesPerFrame();
+      frames -= n;
+    }
+  }
+
+  noise_renderer renderer;
+  sample_format output_format;
+  resample_quality output_quality = resample_quality::medium;
+  std::unique_ptr<polyphase_resampler> output_resampler;
+  int16_t convert_scratch[convert_frames * noise_channels];
+
+  std::unique_ptr<spsc_ring<int16_t>> ring;
+  std::unique_ptr<render_thread> renderer_thread;
+  std::atomic<unsigned long> ring_low_water{0};
+  audio_stats audio;
+
+  // control thread only
+  unsigned long output_buffer_frames = 0;
   double set_volume = .5;
-  double target_volume = 0;
-  double cur_volume = 0;
+  gain_mode active_gain_mode = gain_mode::fixed;
+  tone_settings active_tone;
 };
 
 #endif //WHITENOISE_BT_CONTROLLER_NOISE_DEVICE_H
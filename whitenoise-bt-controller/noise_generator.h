@@ -0,0 +1,193 @@
+#ifndef WHITENOISE_BT_CONTROLLER_NOISE_GENERATOR_H
+#define WHITENOISE_BT_CONTROLLER_NOISE_GENERATOR_H
+
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "noise_source.h"
+#include "ima_adpcm.h"
+#include "resampler.h"
+#include "streaming_source.h"
+
+// procedural noise sources. each one keeps a few words of state per channel,
+// never repeats and needs no file I/O. output levels roughly match brown.raw
+// (-12 to -14 dBFS RMS) so switching sources does not jump in loudness.
+
+inline uint32_t xorshift32(uint32_t &x) {
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+inline uint32_t noise_seed(std::random_device &rd) {
+  uint32_t seed = rd();
+  return seed ? seed : 0x9e3779b9u;
+}
+
+inline int16_t clamp_sample(int32_t val) {
+  return static_cast<int16_t>(std::min(std::max(val, static_cast<int32_t>(INT16_MIN)),
+                                       static_cast<int32_t>(INT16_MAX)));
+}
+
+// uniform white noise from independent xorshift32 generators, one per lane so
+// the inner loop has no dependency between neighbouring samples.
+class white_noise_source : public noise_source {
+ public:
+  white_noise_source() {
+    std::random_device rd;
+    for (auto &s : state) {
+      s = noise_seed(rd);
+    }
+  }
+
+  const int16_t *pull(int16_t *scratch, unsigned long &samples) override {
+    unsigned long i = 0;
+
+    for (; i + lanes <= samples; i += lanes) {
+      for (unsigned long l = 0; l < lanes; l++) {
+        scratch[i + l] = static_cast<int16_t>(static_cast<int32_t>(xorshift32(state[l])) >> 17);
+      }
+    }
+    for (unsigned long l = 0; i < samples; i++, l++) {
+      scratch[i] = static_cast<int16_t>(static_cast<int32_t>(xorshift32(state[l])) >> 17);
+    }
+
+    return scratch;
+  }
+
+ private:
+  static const unsigned long lanes = 8;
+  uint32_t state[lanes];
+};
+
+// pink noise using the Voss-McCartney algorithm: row k of each channel is
+// refreshed every 2^(k+1) frames and the rows are summed with a fresh white
+// sample.
+class pink_noise_source : public noise_source {
+ public:
+  pink_noise_source() {
+    std::random_device rd;
+    for (auto &ch : channels) {
+      ch.rng = noise_seed(rd);
+      for (auto &row : ch.rows) {
+        row = white(ch.rng);
+        ch.sum += row;
+      }
+    }
+  }
+
+  const int16_t *pull(int16_t *scratch, unsigned long &samples) override {
+    for (unsigned long i = 0; i < samples; i += noise_channels) {
+      counter++;
+      unsigned int row = ctz(counter);
+
+      for (unsigned long c = 0; c < noise_channels; c++) {
+        auto &ch = channels[c];
+
+        if (row < rows) {
+          ch.sum -= ch.rows[row];
+          ch.rows[row] = white(ch.rng);
+          ch.sum += ch.rows[row];
+        }
+
+        scratch[i + c] = clamp_sample((ch.sum + white(ch.rng)) * 3 / 4);
+      }
+    }
+
+    return scratch;
+  }
+
+ private:
+  static const unsigned int rows = 12;
+
+  struct channel_state {
+    uint32_t rng = 1;
+    int32_t rows[pink_noise_source::rows] = {};
+    int32_t sum = 0;
+  };
+
+  static int32_t white(uint32_t &rng) {
+    return static_cast<int32_t>(xorshift32(rng)) >> 19;
+  }
+
+  static unsigned int ctz(uint32_t v) {
+    unsigned int n = 0;
+    while (n < 32 && !(v & 1u)) {
+      v >>= 1;
+      n++;
+    }
+    return n;
+  }
+
+  channel_state channels[noise_channels];
+  uint32_t counter = 0;
+};
+
+// brown (red) noise from a leaky integrator over white noise. the leak keeps
+// the signal from drifting and puts the -6 dB/octave corner around 35 Hz.
+class brown_noise_source : public noise_source {
+ public:
+  brown_noise_source() {
+    std::random_device rd;
+    for (auto &s : rng) {
+      s = noise_seed(rd);
+    }
+  }
+
+  const int16_t *pull(int16_t *scratch, unsigned long &samples) override {
+    const float leak = .995f;
+    const float gain = .036f * 32767.0f / 2147483648.0f;
+
+    for (unsigned long i = 0; i < samples; i += noise_channels) {
+      for (unsigned long c = 0; c < noise_channels; c++) {
+        float w = static_cast<float>(static_cast<int32_t>(xorshift32(rng[c])));
+        level[c] = level[c] * leak + w * gain;
+        scratch[i + c] = clamp_sample(static_cast<int32_t>(level[c]));
+      }
+    }
+
+    return scratch;
+  }
+
+ private:
+  uint32_t rng[noise_channels];
+  float level[noise_channels] = {};
+};
+
+// builds the source named by the player.source setting. "stream" plays
+// brown.raw from disk in chunks (main() streams player.stream_path
+// instead), "adpcm" loops brown.adpcm as written by noise-adpcm-encode,
+// resampled if it was not encoded at noise_sample_rate; anything unknown
+// falls back to looping brown.raw from memory, crossfaded over crossfade_frames if given and keeping
+// a prescaled copy if prescale is set
+inline std::unique_ptr<noise_source> make_noise_source(const std::string &name,
+                                                       unsigned long crossfade_frames = 0,
+                                                       bool prescale = false) {
+  if (name == "white") {
+    return std::unique_ptr<noise_source>(new white_noise_source());
+  } else if (name == "pink") {
+    return std::unique_ptr<noise_source>(new pink_noise_source());
+  } else if (name == "brown") {
+    return std::unique_ptr<noise_source>(new brown_noise_source());
+  } else if (name == "stream") {
+    return std::unique_ptr<noise_source>(new streaming_file_source(noise_asset_path("brown.raw").c_str()));
+  } else if (name == "adpcm") {
+    std::unique_ptr<adpcm_loop_source> adpcm(new adpcm_loop_source(noise_asset_path("brown.adpcm").c_str()));
+    unsigned long rate = adpcm->sampleRate();
+
+    if (adpcm->valid() && rate != noise_sample_rate && rate > 0) {
+      std::cerr << "resampling ADPCM noise from " << rate << " Hz" << std::endl;
+      return std::unique_ptr<noise_source>(new resampled_source(std::move(adpcm), rate, resample_quality::medium));
+    }
+    return std::unique_ptr<noise_source>(std::move(adpcm));
+  }
+
+  return std::unique_ptr<noise_source>(
+      new file_loop_source(noise_asset_path("brown.raw").c_str(), crossfade_frames, prescale));
+}
+
+#endif //WHITENOISE_BT_CONTROLLER_NOISE_GENERATOR_H
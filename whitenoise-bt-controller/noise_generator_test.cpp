@@ -25,7 +25,7 @@ int main(int argc, char *argv[]) {
   fmt.setSampleSize(16);
   fmt.setCodec("audio/pcm");
   fmt.setByteOrder(QAudioFormat::LittleEndian);
-  fmt.setSampleType(QAudioFormat::UnSignedInt);
+  fmt.setSampleType(QAudioFormat::SignedInt);
 
   QAudioDeviceInfo info(QAudioDeviceInfo::defaultOutputDevice());
   if (!info.isFormatSupported(fmt)) {
@@ -35,6 +35,13 @@ int main(int argc, char *argv[]) {
 
   noise_device dvc;
 
+  if (argc > 1) {
+    std::cerr << "using noise source: " << argv[1] << std::endl;
+    dvc.setSource(make_noise_source(argv[1]));
+  }
+
+  dvc.startRenderThread(8192, 1024, false);
+
   QAudioOutput audio(fmt, &a);
   QObject::connect(&audio, &QAudioOutput::stateChanged, [] (QAudio::State state) {
     std::cerr << "audio state changed: " << state << std::endl;
@@ -0,0 +1,123 @@
+#ifndef WHITENOISE_BT_CONTROLLER_NOISE_MIXER_H
+#define WHITENOISE_BT_CONTROLLER_NOISE_MIXER_H
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gain_ramp.h"
+#include "noise_generator.h"
+#include "noise_source.h"
+
+// sums any number of sources, each with its own gain and ramp, into one.
+//
+// the output is produced in blocks small enough to stay in cache: every layer
+// is scaled and added into a 32-bit accumulator, and the accumulator is
+// clamped to int16 once at the end, so adding a layer costs one
+// multiply-accumulate per sample and clipping only happens on the final sum.
+//
+// layers are fixed once the mixer is handed to the renderer; their gains can
+// still be changed from the control thread.
+class noise_mixer : public noise_source {
+ public:
+  static constexpr unsigned long block_samples = 512;
+
+  noise_mixer() = default;
+
+  noise_mixer(const noise_mixer &) = delete;
+  noise_mixer &operator=(const noise_mixer &) = delete;
+
+  void addLayer(std::unique_ptr<noise_source> source, double gain) {
+    std::unique_ptr<layer> l(new layer());
+    l->source = std::move(source);
+    l->cur_gain = gain_to_q(gain);
+    l->target_gain.store(l->cur_gain);
+    layers.push_back(std::move(l));
+  }
+
+  unsigned long layerCount() const {
+    return layers.size();
+  }
+
+  // control side
+  void setLayerGain(unsigned long index, double gain) {
+    if (index < layers.size()) {
+      layers[index]->target_gain.store(gain_to_q(gain), std::memory_order_relaxed);
+    }
+  }
+
+  const int16_t *pull(int16_t *scratch, unsigned long &samples) override {
+    unsigned long done = 0;
+
+    while (done < samples) {
+      unsigned long n = std::min(samples - done, block_samples);
+      std::fill(acc, acc + n, 0);
+
+      for (auto &l : layers) {
+        int32_t target = l->target_gain.load(std::memory_order_relaxed);
+        unsigned long filled = 0;
+
+        while (filled < n) {
+          unsigned long got = n - filled;
+          const int16_t *src = l->source->pull(layer_scratch, got);
+          accumulate_gain_ramp_q(src, acc + filled, got, l->cur_gain, target);
+          filled += got;
+        }
+      }
+
+      clamp_accumulator(acc, scratch + done, n);
+      done += n;
+    }
+
+    return scratch;
+  }
+
+ private:
+  struct layer {
+    std::unique_ptr<noise_source> source;
+    int32_t cur_gain = 0;
+    std::atomic<int32_t> target_gain{0};
+  };
+
+  std::vector<std::unique_ptr<layer>> layers;
+  int32_t acc[block_samples];
+  int16_t layer_scratch[block_samples];
+};
+
+// builds a mixer from a player.layers setting such as "brown:1.0,pink:0.25".
+// a layer without a gain plays at 1.0.
+inline std::unique_ptr<noise_mixer> make_noise_mixer(const std::string &spec,
+                                                     unsigned long crossfade_frames = 0) {
+  std::unique_ptr<noise_mixer> mixer(new noise_mixer());
+  std::istringstream layers(spec);
+  std::string item;
+
+  while (std::getline(layers, item, ',')) {
+    if (item.empty()) {
+      continue;
+    }
+
+    auto sep = item.find(':');
+    std::string name = item.substr(0, sep);
+    double gain = 1.0;
+
+    if (sep != std::string::npos) {
+      std::istringstream gain_in(item.substr(sep + 1));
+      if (!(gain_in >> gain)) {
+        std::cerr << "ignoring bad gain for layer: " << item << std::endl;
+        gain = 1.0;
+      }
+    }
+
+    std::cerr << "adding noise layer: " << name << " at " << gain << std::endl;
+    mixer->addLayer(make_noise_source(name, crossfade_frames), gain);
+  }
+
+  return mixer;
+}
+
+#endif //WHITENOISE_BT_CONTROLLER_NOISE_MIXER_H
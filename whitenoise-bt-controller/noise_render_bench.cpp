@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "audio_sink.h"
+#include "noise_device.h"
+#include "noise_mixer.h"
+#include "resampler.h"
+
+// measures what it costs to render audio, without an audio device. a null
+// sink pulls fixed-size buffers from noise_device through QIODevice::read(),
+// exactly like QAudioOutput does, and times every call.
+
+struct bench_result {
+  unsigned long frames;
+  unsigned long buffers;
+  double ns_per_sample;
+  double realtime_factor;
+  double p50_us;
+  double p99_us;
+  double max_us;
+};
+
+class null_sink : public audio_sink {
+ public:
+  explicit null_sink(noise_device &device) : device(device) {
+  }
+
+  const char *name() const override {
+    return "null";
+  }
+
+  bool start() override {
+    return true;
+  }
+
+  void stop() override {
+  }
+
+  void suspend() override {
+  }
+
+  bool resume() override {
+    return true;
+  }
+
+  void setBufferFrames(unsigned long buffer_frames, unsigned long period_frames) override {
+  }
+
+  // pulls enough buffers of `frames` frames to cover `seconds` of audio
+  bench_result run(unsigned long frames, double seconds) {
+    unsigned long bytes = frames * device.outputFormat().bytesPerFrame();
+    auto buffers = static_cast<unsigned long>(seconds * device.outputFormat().rate / frames);
+    buffers = std::max(buffers, 16ul);
+
+    std::vector<char> data(bytes);
+    std::vector<double> times;
+    times.reserve(buffers);
+
+    // warm up caches, and run the volume ramp up to its target so that only
+    // the steady state is timed. the ramp takes a few seconds of audio,
+    // however small the buffers.
+    for (unsigned long i = 0; i < 8 || !device.settled(); i++) {
+      device.read(data.data(), static_cast<qint64>(bytes));
+    }
+
+    double total_ns = 0;
+    for (unsigned long i = 0; i < buffers; i++) {
+      auto start = std::chrono::steady_clock::now();
+      device.read(data.data(), static_cast<qint64>(bytes));
+      auto end = std::chrono::steady_clock::now();
+
+      double ns = std::chrono::duration<double, std::nano>(end - start).count();
+      times.push_back(ns);
+      total_ns += ns;
+    }
+
+    std::sort(times.begin(), times.end());
+
+    bench_result r = {};
+    r.frames = frames;
+    r.buffers = buffers;
+    r.ns_per_sample = total_ns / (static_cast<double>(buffers) * frames * noise_channels);
+    r.realtime_factor = (static_cast<double>(buffers) * frames / device.outputFormat().rate) / (total_ns / 1e9);
+    r.p50_us = times[times.size() / 2] / 1000;
+    r.p99_us = times[std::min(times.size() - 1, times.size() * 99 / 100)] / 1000;
+    r.max_us = times.back() / 1000;
+    return r;
+  }
+
+ private:
+  noise_device &device;
+};
+
+struct idle_result {
+  double cpu_ms_per_s;
+  double wakeups_per_s;
+};
+
+// what this process's render path costs once playback is stopped: either the
+// output keeps pulling silence in real time, or, once the ramp is down, the
+// render thread is parked and nothing pulls. runs a render thread like the
+// application does and counts context switches across all threads as
+// wakeups. there is no audio output here, so what suspending QAudioOutput or
+// the ALSA PCM, and no longer streaming over Bluetooth, saves on top of this
+// is not measured.
+idle_result measure_idle(const std::string &source, double seconds, bool suspend) {
+  const unsigned long frames = 1024;
+
+  noise_device dvc;
+  dvc.setSource(make_noise_source(source, 0, false));
+  dvc.startRenderThread(8192, frames, false);
+  dvc.setVolume(.1);
+  dvc.unquiet();
+
+  std::vector<char> data(frames * dvc.outputFormat().bytesPerFrame());
+  auto period = std::chrono::microseconds(frames * 1000000 / noise_sample_rate);
+  auto next = std::chrono::steady_clock::now();
+  auto pull = [&]() {
+    next += period;
+    std::this_thread::sleep_until(next);
+    dvc.read(data.data(), static_cast<qint64>(data.size()));
+  };
+
+  for (int i = 0; i < 20; i++) {
+    pull();
+  }
+  dvc.quiet();
+  while (!dvc.silent()) {
+    pull();
+  }
+  if (suspend) {
+    dvc.suspend();
+  }
+
+  rusage before = {};
+  getrusage(RUSAGE_SELF, &before);
+  auto start = std::chrono::steady_clock::now();
+
+  if (suspend) {
+    // nothing pulls while the output is suspended
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  } else {
+    next = start;
+    while (std::chrono::steady_clock::now() - start < std::chrono::duration<double>(seconds)) {
+      pull();
+    }
+  }
+
+  rusage after = {};
+  getrusage(RUSAGE_SELF, &after);
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  auto cpu_us = [](const rusage &u) {
+    return (u.ru_utime.tv_sec + u.ru_stime.tv_sec) * 1e6 + u.ru_utime.tv_usec + u.ru_stime.tv_usec;
+  };
+
+  idle_result r = {};
+  r.cpu_ms_per_s = (cpu_us(after) - cpu_us(before)) / 1000 / elapsed;
+  r.wakeups_per_s = static_cast<double>(after.ru_nvcsw + after.ru_nivcsw - before.ru_nvcsw - before.ru_nivcsw)
+      / elapsed;
+  return r;
+}
+
+void usage() {
+  std::cerr << "usage: noise-render-bench [--source NAME] [--layers SPEC] [--crossfade-ms N]\n"
+            << "                          [--float] [--prescale] [--tone BASS,TREBLE[,LOWPASS]]\n"
+            << "                          [--format s16|u16|s24|s32|f32] [--mono] [--rate HZ]\n"
+            << "                          [--quality low|medium|high] [--source-rate HZ]\n"
+            << "                          [--volume V] [--seconds S] [--idle-seconds S]" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  std::string source = "file";
+  std::string layers;
+  unsigned long crossfade_ms = 0;
+  bool floating = false;
+  bool prescale = false;
+  tone_settings tone;
+  sample_format format;
+  resample_quality quality = resample_quality::medium;
+  unsigned long source_rate = noise_sample_rate;
+  double volume = .5;
+  double seconds = 20;
+  double idle_seconds = 5;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--source" && has_value) {
+      source = argv[++i];
+    } else if (arg == "--layers" && has_value) {
+      layers = argv[++i];
+    } else if (arg == "--crossfade-ms" && has_value) {
+      crossfade_ms = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--float") {
+      floating = true;
+    } else if (arg == "--prescale") {
+      prescale = true;
+    } else if (arg == "--tone" && has_value) {
+      char *end = argv[++i];
+      tone.bass_db = static_cast<int>(std::strtol(end, &end, 10));
+      tone.treble_db = *end == ',' ? static_cast<int>(std::strtol(end + 1, &end, 10)) : 0;
+      tone.lowpass_hz = *end == ',' ? static_cast<int>(std::strtol(end + 1, &end, 10)) : 0;
+    } else if (arg == "--format" && has_value) {
+      if (!parse_sample_encoding(argv[++i], format.encoding)) {
+        usage();
+        return 1;
+      }
+    } else if (arg == "--mono") {
+      format.channels = 1;
+    } else if (arg == "--rate" && has_value) {
+      format.rate = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--quality" && has_value) {
+      if (!parse_resample_quality(argv[++i], quality)) {
+        usage();
+        return 1;
+      }
+    } else if (arg == "--source-rate" && has_value) {
+      source_rate = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--volume" && has_value) {
+      volume = std::strtod(argv[++i], nullptr);
+    } else if (arg == "--seconds" && has_value) {
+      seconds = std::strtod(argv[++i], nullptr);
+    } else if (arg == "--idle-seconds" && has_value) {
+      idle_seconds = std::strtod(argv[++i], nullptr);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  noise_device dvc;
+  unsigned long crossfade_frames = crossfade_ms * source_rate / 1000;
+
+  if (!layers.empty()) {
+    dvc.setSource(make_noise_mixer(layers, crossfade_frames));
+  } else if (source_rate != noise_sample_rate) {
+    auto src = make_noise_source(source, crossfade_frames, false);
+    dvc.setSource(std::unique_ptr<noise_source>(new resampled_source(std::move(src), source_rate, quality)));
+  } else {
+    dvc.setSource(make_noise_source(source, crossfade_frames, prescale));
+  }
+
+  dvc.setGainMode(floating ? gain_mode::floating : gain_mode::fixed);
+  dvc.setTone(tone);
+  dvc.setResampleQuality(quality);
+  dvc.setOutputFormat(format);
+  dvc.setVolume(volume);
+  dvc.unquiet();
+
+  null_sink sink(dvc);
+
+  std::cout << "source: " << (layers.empty() ? source : layers)
+            << ", gain: " << (floating ? "float" : "fixed") << " (" << gain_kernel_name() << ")"
+            << (prescale ? ", prescaled" : "")
+            << ", output: " << format.name() << "/" << format.channels << "/" << format.rate
+            << ", tone: " << tone.bass_db << "/" << tone.treble_db << "/" << tone.lowpass_hz
+            << ", " << seconds << " s of audio per buffer size" << std::endl;
+
+  std::cout << std::setw(8) << "frames"
+            << std::setw(10) << "buffers"
+            << std::setw(12) << "ns/sample"
+            << std::setw(12) << "x realtime"
+            << std::setw(12) << "p50 us"
+            << std::setw(12) << "p99 us"
+            << std::setw(12) << "max us" << std::endl;
+
+  for (unsigned long frames = 64; frames <= 16384; frames *= 2) {
+    bench_result r = sink.run(frames, seconds);
+
+    std::cout << std::fixed
+              << std::setw(8) << r.frames
+              << std::setw(10) << r.buffers
+              << std::setprecision(2) << std::setw(12) << r.ns_per_sample
+              << std::setprecision(0) << std::setw(12) << r.realtime_factor
+              << std::setprecision(1) << std::setw(12) << r.p50_us
+              << std::setw(12) << r.p99_us
+              << std::setw(12) << r.max_us << std::endl;
+  }
+
+  if (idle_seconds > 0) {
+    std::cout << std::endl << "stopped, " << std::setprecision(0) << idle_seconds << " s each, "
+              << (layers.empty() ? source : "file") << " source at the output's pace; render path only,"
+              << " not the audio output or Bluetooth" << std::endl;
+    std::cout << std::setw(20) << "" << std::setw(12) << "CPU ms/s" << std::setw(12) << "wakeups/s" << std::endl;
+
+    const char *names[] = {"rendering silence", "render parked"};
+    for (int suspend = 0; suspend < 2; suspend++) {
+      idle_result r = measure_idle(layers.empty() ? source : "file", idle_seconds, suspend != 0);
+      std::cout << std::setw(20) << std::left << names[suspend] << std::right
+                << std::setprecision(2) << std::setw(12) << r.cpu_ms_per_s
+                << std::setprecision(1) << std::setw(12) << r.wakeups_per_s << std::endl;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,179 @@
+#ifndef WHITENOISE_BT_CONTROLLER_NOISE_RENDERER_H
+#define WHITENOISE_BT_CONTROLLER_NOISE_RENDERER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "audio_params.h"
+#include "gain_ramp.h"
+#include "noise_generator.h"
+#include "tone_filter.h"
+
+// turns the current source and volume into interleaved stereo int16 PCM.
+// render() runs on the audio path; the setters are for the control thread.
+class noise_renderer {
+ public:
+  noise_renderer() : source(make_noise_source("file")) {
+  }
+
+  // control side
+
+  void setTargetVolume(double vol) {
+    params.setTargetVolume(vol);
+  }
+
+  void setSource(std::unique_ptr<noise_source> src) {
+    params.setSource(std::move(src));
+  }
+
+  void setGainMode(gain_mode mode) {
+    params.setGainMode(mode);
+  }
+
+  void setTone(const tone_settings &settings) {
+    tone.set(settings);
+  }
+
+  void setFade(unsigned long frames, fade_curve curve, bool in = false) {
+    params.setFade(frames, curve, in);
+  }
+
+  // how many samples in a row have been rendered at zero gain
+  unsigned long silentSamples() const {
+    return silent_samples.load(std::memory_order_relaxed);
+  }
+
+  // true once the last render() ended with the gain at its target and no
+  // fade running
+  bool settled() const {
+    return gain_settled.load(std::memory_order_relaxed);
+  }
+
+  // audio side
+
+  // fills `samples` samples, which must be a multiple of noise_channels
+  void render(int16_t *out, unsigned long samples) {
+    params.updateSource(source);
+    audio_params_snapshot p = params.snapshot();
+
+    if (p.mode != active_gain_mode) {
+      // carry the current ramp position over to the other representation
+      if (p.mode == gain_mode::fixed) {
+        cur_gain_q = gain_to_q(cur_volume);
+      } else {
+        cur_volume = gain_from_q(cur_gain_q);
+      }
+      active_gain_mode = p.mode;
+    }
+
+    audio_fade fade = params.fade();
+    if (fade.generation != fade_generation) {
+      fade_generation = fade.generation;
+      fade_pos = 0;
+    }
+
+    // a fade follows its own curve instead of the volume ramp: the gain goes
+    // from where it is to the curve's value at the end of this buffer, evenly
+    // over the buffer, however steep that is. a finished fade-in is the same
+    // as no fade.
+    double target_volume = p.target_volume;
+    double ramp_step = gain_ramp_step;
+    int32_t ramp_step_q = gain_q_ramp_step;
+    bool fading = fade.frames > 0 && !(fade.in && fade_pos == fade.frames);
+    if (fading) {
+      fade_pos = std::min(fade_pos + samples / noise_channels, fade.frames);
+      double gain = fade_gain(fade.curve, static_cast<double>(fade_pos) / fade.frames);
+      target_volume *= fade.in ? 1 - gain : gain;
+
+      ramp_step = std::max(ramp_step, std::fabs(target_volume - cur_volume) / samples);
+      int64_t delta_q = std::abs(static_cast<int64_t>(gain_to_q(target_volume)) - cur_gain_q);
+      ramp_step_q = static_cast<int32_t>(std::max<int64_t>(ramp_step_q, (delta_q + samples - 1) / samples));
+    }
+
+    int32_t target_gain_q = gain_to_q(target_volume);
+    bool was_silent = active_gain_mode == gain_mode::fixed ? cur_gain_q == 0 : cur_volume == 0;
+    unsigned long done = 0;
+
+    while (done < samples) {
+      unsigned long n = samples - done;
+      const int16_t *pulled = source->pull(out + done, n);
+      auto *src = reinterpret_cast<const char *>(pulled);
+      auto *dst = reinterpret_cast<char *>(out + done);
+
+      // once the ramp has settled the source may already hold the scaled
+      // samples, leaving only a copy. not while fading, where the gain
+      // settles on a new value every buffer, and not at gain 0, which only
+      // lasts until the output is suspended and is not worth a copy.
+      const int16_t *scaled = nullptr;
+      if (active_gain_mode == gain_mode::fixed && cur_gain_q == target_gain_q && target_gain_q != 0 && !fading) {
+        scaled = source->prescaled(pulled, cur_gain_q);
+      }
+
+      if (scaled) {
+        std::memcpy(dst, scaled, n * 2);
+      } else if (active_gain_mode == gain_mode::fixed) {
+        apply_gain_ramp_q(src, dst, n, cur_gain_q, target_gain_q, ramp_step_q);
+      } else {
+        apply_gain_ramp(src, dst, n, cur_volume, target_volume, ramp_step);
+      }
+
+      done += n;
+    }
+
+    tone.process(out, samples);
+
+    gain_settled.store(!fading && (active_gain_mode == gain_mode::fixed ? cur_gain_q == target_gain_q
+                                                                          : cur_volume == target_volume),
+                       std::memory_order_relaxed);
+
+    bool silent = active_gain_mode == gain_mode::fixed ? cur_gain_q == 0 : cur_volume == 0;
+    if (was_silent && silent) {
+      silent_samples.fetch_add(samples, std::memory_order_relaxed);
+    } else {
+      silent_samples.store(0, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  audio_params params;
+  tone_filter tone;
+
+  std::unique_ptr<noise_source> source;
+  double cur_volume = 0;
+  int32_t cur_gain_q = 0;
+  gain_mode active_gain_mode = gain_mode::fixed;
+
+  unsigned int fade_generation = 0;
+  unsigned long fade_pos = 0;
+  std::atomic<unsigned long> silent_samples{0};
+  std::atomic<bool> gain_settled{false};
+};
+
+// the longest it took `renderer` to render one block of `block_frames` frames,
+// in ns, over `blocks` blocks. renders on the calling thread.
+inline unsigned long measure_render_cost(noise_renderer &renderer, unsigned long block_frames,
+                                         unsigned long blocks) {
+  std::vector<int16_t> block(block_frames * noise_channels);
+  unsigned long worst = 0;
+
+  // the first few blocks fault in the source and the caches
+  for (unsigned long i = 0; i < blocks + 8; i++) {
+    auto start = std::chrono::steady_clock::now();
+    renderer.render(block.data(), block.size());
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    if (i >= 8) {
+      worst = std::max(worst, static_cast<unsigned long>(ns));
+    }
+  }
+
+  return worst;
+}
+
+#endif //WHITENOISE_BT_CONTROLLER_NOISE_RENDERER_H
@@ -0,0 +1,150 @@
+#ifndef WHITENOISE_BT_CONTROLLER_NOISE_SOURCE_H
+#define WHITENOISE_BT_CONTROLLER_NOISE_SOURCE_H
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "noise_asset.h"
+#include "prescale_cache.h"
+
+static const unsigned long noise_channels = 2;
+static const unsigned long noise_sample_rate = 44100;
+
+// a source of interleaved stereo int16 PCM.
+class noise_source {
+ public:
+  virtual ~noise_source() = default;
+
+  // produces up to `samples` samples (a multiple of noise_channels) and
+  // returns a pointer to them. sources that generate audio write into
+  // `scratch`, which has room for `samples`; sources backed by memory may
+  // return a pointer into their own storage instead. `samples` is updated to
+  // the number of samples available at the returned pointer.
+  virtual const int16_t *pull(int16_t *scratch, unsigned long &samples) = 0;
+
+  // given samples just returned by pull(), returns the same samples already
+  // scaled by the Q30 gain `gain_q` if the source keeps such a copy, or
+  // nullptr otherwise
+  virtual const int16_t *prescaled(const int16_t *pulled, int32_t gain_q) {
+    return nullptr;
+  }
+};
+
+// loops a raw PCM asset.
+//
+// a plain loop jumps from the last frame straight back to the first, which
+// clicks. with a crossfade of F frames the loop instead plays frames
+// [F, N - F) of the asset followed by a seam that fades the last F frames out
+// while fading the first F frames in, and then continues at frame F again.
+// the seam is computed once at load time, so the steady state is still a
+// plain copy out of the asset.
+//
+// with prescale set the source also keeps a copy of the loop at the current
+// volume (see prescale_cache), at the cost of two extra copies of the loop in
+// memory.
+class file_loop_source : public noise_source {
+ public:
+  explicit file_loop_source(const char *path, unsigned long crossfade_frames = 0, bool prescale = false) {
+    if (!asset.load(path)) {
+      return;
+    }
+
+    // only loop over whole frames
+    unsigned long frames = asset.size() / 2 / noise_channels;
+    auto *data = reinterpret_cast<const int16_t *>(asset.data());
+
+    if (crossfade_frames > 0 && crossfade_frames * 2 <= frames) {
+      build_seam(data, frames, crossfade_frames);
+      spans[0] = {data + crossfade_frames * noise_channels, (frames - 2 * crossfade_frames) * noise_channels};
+      spans[1] = {seam.data(), seam.size()};
+      span_count = 2;
+
+      std::cerr << "crossfading noise loop over " << crossfade_frames << " frames" << std::endl;
+    } else {
+      if (crossfade_frames > 0) {
+        std::cerr << "noise buffer too short to crossfade; looping without it" << std::endl;
+      }
+
+      spans[0] = {data, frames * noise_channels};
+      span_count = frames > 0 ? 1 : 0;
+    }
+
+    if (prescale && span_count > 0) {
+      std::vector<prescale_cache::span> cache_spans;
+      for (unsigned long i = 0; i < span_count; i++) {
+        cache_spans.push_back({spans[i].data, spans[i].samples});
+      }
+      cache.reset(new prescale_cache(std::move(cache_spans)));
+    }
+  }
+
+  bool valid() const {
+    return span_count > 0;
+  }
+
+  const int16_t *pull(int16_t *scratch, unsigned long &samples) override {
+    if (span_count == 0) {
+      std::fill(scratch, scratch + samples, 0);
+      return scratch;
+    }
+
+    const loop_span &span = spans[cur_span];
+    samples = std::min(samples, span.samples - pos);
+    const int16_t *out = span.data + pos;
+
+    pos += samples;
+    if (pos == span.samples) {
+      pos = 0;
+      cur_span = (cur_span + 1) % span_count;
+    }
+
+    return out;
+  }
+
+  const int16_t *prescaled(const int16_t *pulled, int32_t gain_q) override {
+    return cache ? cache->lookup(pulled, gain_q) : nullptr;
+  }
+
+ private:
+  struct loop_span {
+    const int16_t *data;
+    unsigned long samples;
+  };
+
+  void build_seam(const int16_t *data, unsigned long frames, unsigned long fade_frames) {
+    const int16_t *tail = data + (frames - fade_frames) * noise_channels;
+    const int16_t *head = data;
+
+    seam.resize(fade_frames * noise_channels);
+
+    for (unsigned long i = 0; i < fade_frames; i++) {
+      // equal-power curve keeps the loudness steady across uncorrelated noise
+      double theta = M_PI / 2 * (i + .5) / fade_frames;
+      double fade_out = std::cos(theta);
+      double fade_in = std::sin(theta);
+
+      for (unsigned long c = 0; c < noise_channels; c++) {
+        unsigned long idx = i * noise_channels + c;
+        double val = tail[idx] * fade_out + head[idx] * fade_in;
+        val = std::min(std::max(std::round(val), -32768.0), 32767.0);
+        seam[idx] = static_cast<int16_t>(val);
+      }
+    }
+  }
+
+  noise_asset asset;
+  std::vector<int16_t> seam;
+
+  loop_span spans[2] = {};
+  unsigned long span_count = 0;
+  unsigned long cur_span = 0;
+  unsigned long pos = 0;
+
+  std::unique_ptr<prescale_cache> cache;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_NOISE_SOURCE_H
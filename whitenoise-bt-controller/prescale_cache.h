@@ -0,0 +1,129 @@
+#ifndef WHITENOISE_BT_CONTROLLER_PRESCALE_CACHE_H
+#define WHITENOISE_BT_CONTROLLER_PRESCALE_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "gain_ramp.h"
+#include "thread_wakeup.h"
+
+// keeps a copy of a looping asset already scaled by the current volume, so
+// that once the volume ramp has settled the audio path only has to memcpy.
+//
+// the copy is built on a background thread whenever the audio side asks for a
+// gain that is not cached yet; until it is ready the audio side keeps scaling
+// live. there are two buffers: the audio side reads the published one and
+// announces which one it is reading, and the builder only ever overwrites the
+// other one once the audio side has let go of it. the audio side never waits.
+class prescale_cache {
+ public:
+  struct span {
+    const int16_t *data;
+    unsigned long samples;
+  };
+
+  explicit prescale_cache(std::vector<span> spans) : spans(std::move(spans)) {
+    builder = std::thread([this]() {
+      run();
+    });
+  }
+
+  prescale_cache(const prescale_cache &) = delete;
+  prescale_cache &operator=(const prescale_cache &) = delete;
+
+  ~prescale_cache() {
+    running.store(false);
+    wake.post();
+    builder.join();
+  }
+
+  // audio side. `src` points into one of the spans; returns the matching
+  // samples scaled by the Q30 gain `gain`, or nullptr if that copy is not
+  // ready, in which case it is requested. the returned data stays valid until
+  // the next call.
+  const int16_t *lookup(const int16_t *src, int32_t gain) {
+    int p;
+    do {
+      p = published.load();
+      in_use.store(p);
+    } while (published.load() != p);
+
+    if (p < 0 || buffers[p].gain != gain) {
+      // every miss wakes the builder, not only a new gain: it may have had
+      // to skip the buffer this side was holding on to until now
+      in_use.store(-1);
+      requested.store(gain);
+      wake.post();
+      return nullptr;
+    }
+
+    unsigned long offset = 0;
+    for (const auto &s : spans) {
+      if (src >= s.data && src < s.data + s.samples) {
+        return buffers[p].data.data() + offset + (src - s.data);
+      }
+      offset += s.samples;
+    }
+
+    return nullptr;
+  }
+
+ private:
+  struct buffer {
+    std::vector<int16_t> data;
+    int32_t gain = -1;
+  };
+
+  void run() {
+    int32_t built_gain = -1;
+
+    while (running.load()) {
+      int32_t gain = requested.load();
+      int target = published.load() == 0 ? 1 : 0;
+
+      if (gain < 0 || gain == built_gain || in_use.load() == target) {
+        wake.wait();
+        continue;
+      }
+
+      build(buffers[target], gain);
+      published.store(target);
+      built_gain = gain;
+    }
+  }
+
+  void build(buffer &buf, int32_t gain) {
+    unsigned long total = 0;
+    for (const auto &s : spans) {
+      total += s.samples;
+    }
+    buf.data.resize(total);
+
+    unsigned long offset = 0;
+    for (const auto &s : spans) {
+      // same kernel as the live path, so switching between them is seamless
+      int32_t cur = gain;
+      apply_gain_ramp_q(reinterpret_cast<const char *>(s.data),
+                        reinterpret_cast<char *>(buf.data.data() + offset),
+                        s.samples, cur, gain);
+      offset += s.samples;
+    }
+
+    buf.gain = gain;
+  }
+
+  std::vector<span> spans;
+  buffer buffers[2];
+
+  std::atomic<int> published{-1};
+  std::atomic<int> in_use{-1};
+  std::atomic<int32_t> requested{-1};
+
+  thread_wakeup wake;
+  std::atomic<bool> running{true};
+  std::thread builder;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_PRESCALE_CACHE_H
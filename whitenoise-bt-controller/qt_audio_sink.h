@@ -0,0 +1,165 @@
+#ifndef WHITENOISE_BT_CONTROLLER_QT_AUDIO_SINK_H
+#define WHITENOISE_BT_CONTROLLER_QT_AUDIO_SINK_H
+
+#include <iostream>
+
+#include <QAudioDeviceInfo>
+#include <QAudioFormat>
+#include <QAudioOutput>
+
+#include "audio_sink.h"
+#include "noise_device.h"
+#include "sample_format.h"
+
+// plays through Qt Multimedia, which pulls from the device on the thread
+// that owns the QAudioOutput
+class qt_audio_sink : public audio_sink {
+ public:
+  qt_audio_sink(noise_device &device, QObject *parent) : device(device) {
+    QAudioDeviceInfo info = QAudioDeviceInfo::defaultOutputDevice();
+    sample_format fmt = negotiate(info);
+
+    device.setOutputFormat(fmt);
+    player = new QAudioOutput(info, to_qt_format(fmt), parent);
+
+    // Qt reports a starved output as going idle with an underrun error
+    QObject::connect(player, &QAudioOutput::stateChanged, [this](QAudio::State state) {
+      this->device.stats().recordStateChange(state == QAudio::IdleState && player->error() == QAudio::UnderrunError);
+    });
+  }
+
+  qt_audio_sink(const qt_audio_sink &) = delete;
+  qt_audio_sink &operator=(const qt_audio_sink &) = delete;
+
+  ~qt_audio_sink() override {
+    // stop pulling before the device goes away
+    player->stop();
+    delete player;
+  }
+
+  const char *name() const override {
+    return "qt";
+  }
+
+  bool start() override {
+    if (buffer_frames > 0) {
+      player->setBufferSize(static_cast<int>(buffer_frames * device.outputFormat().bytesPerFrame()));
+    }
+
+    player->start(&device);
+
+    auto frames = static_cast<unsigned long>(player->bufferSize()) / device.outputFormat().bytesPerFrame();
+    device.setOutputBufferFrames(frames);
+    std::cerr << "qt: output buffer is " << frames << " frames" << std::endl;
+    return player->error() == QAudio::NoError;
+  }
+
+  void stop() override {
+    player->stop();
+  }
+
+  // QAudioOutput only takes a buffer size; the backend derives its period
+  void setBufferFrames(unsigned long frames, unsigned long period_frames) override {
+    buffer_frames = frames;
+  }
+
+  void suspend() override {
+    player->suspend();
+  }
+
+  bool resume() override {
+    player->resume();
+    return player->error() == QAudio::NoError;
+  }
+
+  QAudioOutput *output() {
+    return player;
+  }
+
+ private:
+  static QAudioFormat to_qt_format(const sample_format &fmt) {
+    QAudioFormat qfmt;
+
+    qfmt.setSampleRate(static_cast<int>(fmt.rate));
+    qfmt.setChannelCount(static_cast<int>(fmt.channels));
+    qfmt.setSampleSize(static_cast<int>(fmt.bytesPerSample() * 8));
+    qfmt.setCodec("audio/pcm");
+    qfmt.setByteOrder(QAudioFormat::LittleEndian);
+
+    switch (fmt.encoding) {
+      case sample_encoding::u16:
+        qfmt.setSampleType(QAudioFormat::UnSignedInt);
+        break;
+      case sample_encoding::f32:
+        qfmt.setSampleType(QAudioFormat::Float);
+        break;
+      default:
+        qfmt.setSampleType(QAudioFormat::SignedInt);
+        break;
+    }
+
+    return qfmt;
+  }
+
+  // maps a Qt format onto one we can convert to
+  static bool from_qt_format(const QAudioFormat &qfmt, sample_format &fmt) {
+    if (qfmt.codec() != "audio/pcm" || qfmt.byteOrder() != QAudioFormat::LittleEndian ||
+        qfmt.channelCount() < 1 || qfmt.channelCount() > static_cast<int>(noise_channels) ||
+        qfmt.sampleRate() <= 0) {
+      return false;
+    }
+
+    fmt.channels = static_cast<unsigned long>(qfmt.channelCount());
+    fmt.rate = static_cast<unsigned long>(qfmt.sampleRate());
+
+    if (qfmt.sampleType() == QAudioFormat::SignedInt && qfmt.sampleSize() == 16) {
+      fmt.encoding = sample_encoding::s16;
+    } else if (qfmt.sampleType() == QAudioFormat::UnSignedInt && qfmt.sampleSize() == 16) {
+      fmt.encoding = sample_encoding::u16;
+    } else if (qfmt.sampleType() == QAudioFormat::SignedInt && qfmt.sampleSize() == 24) {
+      fmt.encoding = sample_encoding::s24;
+    } else if (qfmt.sampleType() == QAudioFormat::SignedInt && qfmt.sampleSize() == 32) {
+      fmt.encoding = sample_encoding::s32;
+    } else if (qfmt.sampleType() == QAudioFormat::Float && qfmt.sampleSize() == 32) {
+      fmt.encoding = sample_encoding::f32;
+    } else {
+      return false;
+    }
+
+    return true;
+  }
+
+  // picks the format and rate the device would rather have, so that the sound
+  // server does not convert or resample behind our back. falls back to what the device suggests
+  // instead, and to plain s16 stereo if that is not something we can produce.
+  static sample_format negotiate(const QAudioDeviceInfo &info) {
+    sample_format fmt;
+    sample_format preferred;
+
+    if (from_qt_format(info.preferredFormat(), preferred) &&
+        info.isFormatSupported(to_qt_format(preferred))) {
+      fmt = preferred;
+    } else if (!info.isFormatSupported(to_qt_format(fmt))) {
+      QAudioFormat nearest = info.nearestFormat(to_qt_format(fmt));
+      sample_format near;
+
+      if (from_qt_format(nearest, near)) {
+        fmt = near;
+      } else {
+        std::cerr << "qt: " << info.deviceName().toStdString()
+                  << " does not support any format we can produce; trying s16 stereo anyway" << std::endl;
+      }
+    }
+
+    std::cerr << "qt: playing to " << info.deviceName().toStdString()
+              << " as " << fmt.name() << ", " << fmt.channels << " channel(s), "
+              << fmt.rate << " Hz" << std::endl;
+    return fmt;
+  }
+
+  noise_device &device;
+  QAudioOutput *player;
+  unsigned long buffer_frames = 0;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_QT_AUDIO_SINK_H
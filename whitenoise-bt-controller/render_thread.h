@@ -0,0 +1,135 @@
+#ifndef WHITENOISE_BT_CONTROLLER_RENDER_THREAD_H
+#define WHITENOISE_BT_CONTROLLER_RENDER_THREAD_H
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "noise_renderer.h"
+#include "spsc_ring.h"
+
+// keeps a ring of rendered PCM topped up from its own thread, so the audio
+// device only has to copy out of the ring and never waits on the control
+// thread's event loop.
+class render_thread {
+ public:
+  render_thread(noise_renderer &renderer, spsc_ring<int16_t> &ring, unsigned long block_frames)
+      : renderer(renderer), ring(ring), block_samples(block_frames * noise_channels) {
+  }
+
+  render_thread(const render_thread &) = delete;
+  render_thread &operator=(const render_thread &) = delete;
+
+  ~render_thread() {
+    stop();
+  }
+
+  // realtime asks for SCHED_FIFO and locks the process in memory so that
+  // rendering is not delayed by page faults; both need CAP_SYS_NICE /
+  // CAP_IPC_LOCK or suitable rlimits and are skipped with a warning otherwise.
+  void start(bool realtime, int priority = 10) {
+    if (worker.joinable()) {
+      return;
+    }
+
+    if (realtime && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      std::cerr << "could not lock render memory: " << std::strerror(errno) << std::endl;
+    }
+
+    running.store(true);
+    worker = std::thread([this, realtime, priority]() {
+      if (realtime) {
+        sched_param param = {};
+        param.sched_priority = priority;
+
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+          std::cerr << "could not make render thread realtime: " << std::strerror(err) << std::endl;
+        }
+      }
+
+      run();
+    });
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(pause_mutex);
+      running.store(false);
+    }
+    pause_wake.notify_one();
+
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+
+  // parks the thread until resume(), without waking up at all in between
+  void pause() {
+    std::lock_guard<std::mutex> lock(pause_mutex);
+    paused.store(true);
+  }
+
+  void resume() {
+    {
+      std::lock_guard<std::mutex> lock(pause_mutex);
+      paused.store(false);
+    }
+    pause_wake.notify_one();
+  }
+
+ private:
+  void wait_while_paused() {
+    if (!paused.load(std::memory_order_relaxed)) {
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(pause_mutex);
+    pause_wake.wait(lock, [this]() {
+      return !paused.load() || !running.load();
+    });
+  }
+
+  void run() {
+    // sleep for half a block whenever the ring is full, which keeps a block of
+    // headroom while waking up about twice per block
+    auto idle = std::chrono::microseconds(block_samples / noise_channels * 1000000 / noise_sample_rate / 2);
+
+    while (running.load(std::memory_order_relaxed)) {
+      if (ring.writable() < block_samples) {
+        std::this_thread::sleep_for(idle);
+        wait_while_paused();
+        continue;
+      }
+
+      unsigned long contiguous = 0;
+      int16_t *dst = ring.write_ptr(contiguous);
+      unsigned long n = std::min(contiguous, block_samples);
+
+      renderer.render(dst, n);
+      ring.commit_write(n);
+    }
+  }
+
+  noise_renderer &renderer;
+  spsc_ring<int16_t> &ring;
+  unsigned long block_samples;
+
+  std::atomic<bool> running{false};
+  std::thread worker;
+
+  std::mutex pause_mutex;
+  std::condition_variable pause_wake;
+  std::atomic<bool> paused{false};
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_RENDER_THREAD_H
@@ -0,0 +1,248 @@
+#ifndef WHITENOISE_BT_CONTROLLER_RESAMPLER_H
+#define WHITENOISE_BT_CONTROLLER_RESAMPLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "gain_ramp.h"
+#include "noise_source.h"
+
+// trades CPU for stopband attenuation. taps are per phase at the lower of the
+// two rates, so the cost per output sample is roughly `taps` multiply-adds.
+enum class resample_quality {
+  low,     // 16 taps, ~50 dB
+  medium,  // 32 taps, ~80 dB
+  high     // 64 taps, ~110 dB
+};
+
+inline bool parse_resample_quality(const std::string &name, resample_quality &quality) {
+  if (name == "low") {
+    quality = resample_quality::low;
+  } else if (name == "medium") {
+    quality = resample_quality::medium;
+  } else if (name == "high") {
+    quality = resample_quality::high;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// dot product of `taps` (a multiple of 4) coefficients with both channels
+inline void resample_dot(const float *coeffs, const float *left, const float *right, unsigned long taps,
+                         float &out_left, float &out_right) {
+  unsigned long k = 0;
+
+#if defined(WHITENOISE_GAIN_AVX2) || defined(WHITENOISE_GAIN_SSE2)
+  __m128 acc_l = _mm_setzero_ps();
+  __m128 acc_r = _mm_setzero_ps();
+  for (; k + 4 <= taps; k += 4) {
+    __m128 c = _mm_loadu_ps(coeffs + k);
+    acc_l = _mm_add_ps(acc_l, _mm_mul_ps(c, _mm_loadu_ps(left + k)));
+    acc_r = _mm_add_ps(acc_r, _mm_mul_ps(c, _mm_loadu_ps(right + k)));
+  }
+  // horizontal sums of both accumulators at once
+  __m128 lo = _mm_unpacklo_ps(acc_l, acc_r);
+  __m128 hi = _mm_unpackhi_ps(acc_l, acc_r);
+  __m128 sum = _mm_add_ps(lo, hi);
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  out_left = _mm_cvtss_f32(sum);
+  out_right = _mm_cvtss_f32(_mm_shuffle_ps(sum, sum, 1));
+  return;
+#elif defined(WHITENOISE_GAIN_NEON)
+  float32x4_t acc_l = vdupq_n_f32(0);
+  float32x4_t acc_r = vdupq_n_f32(0);
+  for (; k + 4 <= taps; k += 4) {
+    float32x4_t c = vld1q_f32(coeffs + k);
+    acc_l = vmlaq_f32(acc_l, c, vld1q_f32(left + k));
+    acc_r = vmlaq_f32(acc_r, c, vld1q_f32(right + k));
+  }
+  float32x2_t l = vadd_f32(vget_low_f32(acc_l), vget_high_f32(acc_l));
+  float32x2_t r = vadd_f32(vget_low_f32(acc_r), vget_high_f32(acc_r));
+  float32x2_t sum = vpadd_f32(l, r);
+  out_left = vget_lane_f32(sum, 0);
+  out_right = vget_lane_f32(sum, 1);
+  return;
+#else
+  float acc_l = 0;
+  float acc_r = 0;
+  for (; k < taps; k++) {
+    acc_l += coeffs[k] * left[k];
+    acc_r += coeffs[k] * right[k];
+  }
+  out_left = acc_l;
+  out_right = acc_r;
+#endif
+}
+
+// converts interleaved stereo int16 from one rate to another with a
+// Kaiser-windowed sinc, split into one short filter per output phase.
+//
+// the ratio is reduced to out/in = up/down; output frame t then sits at
+// input position t * down / up, and uses the coefficient row for phase
+// (t * down) % up against the `taps` input frames ending there. all rows are
+// computed up front, so producing a frame is one dot product per channel.
+class polyphase_resampler {
+ public:
+  static constexpr unsigned long block_frames = 256;
+
+  polyphase_resampler(unsigned long in_rate, unsigned long out_rate, resample_quality quality) {
+    unsigned long g = std::gcd(in_rate, out_rate);
+    up = out_rate / g;
+    down = in_rate / g;
+
+    unsigned long base_taps = 32;
+    double beta = 7.9;
+    double rolloff = .86;
+
+    if (quality == resample_quality::low) {
+      base_taps = 16;
+      beta = 4.5;
+      rolloff = .80;
+    } else if (quality == resample_quality::high) {
+      base_taps = 64;
+      beta = 11;
+      rolloff = .90;
+    }
+
+    // when decimating the filter has to reach further back to keep the same
+    // transition width relative to the lower rate
+    taps = base_taps * std::max(up, down) / up;
+    taps = (taps + 3) / 4 * 4;
+
+    // prototype filter at in_rate * up, cut off below the lower Nyquist
+    double cutoff = rolloff * .5 / std::max(up, down);
+    unsigned long length = taps * up;
+    double center = (length - 1) / 2.0;
+    double norm = bessel_i0(beta);
+
+    coeffs.resize(length);
+    for (unsigned long p = 0; p < up; p++) {
+      for (unsigned long j = 0; j < taps; j++) {
+        // rows are reversed so they line up with the history, oldest first
+        unsigned long n = (taps - 1 - j) * up + p;
+        double x = n - center;
+        double sinc = x == 0 ? 1 : std::sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+        double r = x / center;
+        double window = bessel_i0(beta * std::sqrt(std::max(0.0, 1 - r * r))) / norm;
+        coeffs[p * taps + j] = static_cast<float>(2 * cutoff * sinc * window * up);
+      }
+    }
+
+    for (auto &h : history) {
+      h.assign(taps - 1 + block_frames, 0.0f);
+    }
+    filled = taps - 1;
+    next = taps - 1;
+  }
+
+  unsigned long tapCount() const {
+    return taps;
+  }
+
+  // produces `frames` output frames into `out`. `fill(int16_t *in, frames)`
+  // is called for blocks of input frames as they are needed.
+  template<typename Fill>
+  void render(int16_t *out, unsigned long frames, Fill &&fill) {
+    for (unsigned long t = 0; t < frames; t++) {
+      while (next >= filled) {
+        refill(fill);
+      }
+
+      const float *row = coeffs.data() + phase * taps;
+      unsigned long start = next + 1 - taps;
+      float y[2];
+      resample_dot(row, history[0].data() + start, history[1].data() + start, taps, y[0], y[1]);
+
+      for (unsigned long c = 0; c < 2; c++) {
+        float v = std::min(std::max(y[c], -32768.0f), 32767.0f);
+        out[t * 2 + c] = static_cast<int16_t>(std::lrint(v));
+      }
+
+      phase += down;
+      next += phase / up;
+      phase %= up;
+    }
+  }
+
+ private:
+  template<typename Fill>
+  void refill(Fill &fill) {
+    // keep the last taps - 1 frames as history for the next block
+    unsigned long keep = taps - 1;
+    unsigned long drop = filled - keep;
+    for (auto &h : history) {
+      std::memmove(h.data(), h.data() + drop, keep * sizeof(float));
+    }
+    next -= drop;
+    filled = keep;
+
+    fill(block, block_frames);
+
+    for (unsigned long i = 0; i < block_frames; i++) {
+      history[0][filled + i] = block[i * 2];
+      history[1][filled + i] = block[i * 2 + 1];
+    }
+    filled += block_frames;
+  }
+
+  static double bessel_i0(double x) {
+    double sum = 1;
+    double term = 1;
+    for (int k = 1; k < 50; k++) {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+      if (term < sum * 1e-12) {
+        break;
+      }
+    }
+    return sum;
+  }
+
+  unsigned long up = 1;
+  unsigned long down = 1;
+  unsigned long taps = 0;
+  std::vector<float> coeffs;
+
+  std::vector<float> history[2];
+  int16_t block[block_frames * 2];
+  unsigned long filled = 0;
+  unsigned long next = 0;
+  unsigned long phase = 0;
+};
+
+// plays a source recorded at some other rate at noise_sample_rate
+class resampled_source : public noise_source {
+ public:
+  resampled_source(std::unique_ptr<noise_source> source, unsigned long rate, resample_quality quality)
+      : source(std::move(source)),
+        resampler(rate, noise_sample_rate, quality) {
+  }
+
+  const int16_t *pull(int16_t *scratch, unsigned long &samples) override {
+    resampler.render(scratch, samples / noise_channels, [this](int16_t *in, unsigned long frames) {
+      unsigned long done = 0;
+      while (done < frames * noise_channels) {
+        unsigned long n = frames * noise_channels - done;
+        const int16_t *src = source->pull(in + done, n);
+        if (src != in + done) {
+          std::memcpy(in + done, src, n * 2);
+        }
+        done += n;
+      }
+    });
+    return scratch;
+  }
+
+ private:
+  std::unique_ptr<noise_source> source;
+  polyphase_resampler resampler;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_RESAMPLER_H
@@ -0,0 +1,231 @@
+#ifndef WHITENOISE_BT_CONTROLLER_SAMPLE_FORMAT_H
+#define WHITENOISE_BT_CONTROLLER_SAMPLE_FORMAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "gain_ramp.h"
+#include "noise_source.h"
+
+// sample encodings the output stage can produce, all little endian.
+// s24 is packed into three bytes.
+enum class sample_encoding {
+  s16,
+  u16,
+  s24,
+  s32,
+  f32
+};
+
+// what the audio output is fed. the pipeline itself always renders signed
+// 16-bit stereo at noise_sample_rate; anything else is resampled and
+// converted on the way out, so the sound server does not have to.
+struct sample_format {
+  sample_encoding encoding = sample_encoding::s16;
+  unsigned long channels = noise_channels;
+  unsigned long rate = noise_sample_rate;
+
+  // true if rendered samples can go to the output unchanged
+  bool native() const {
+    return encoding == sample_encoding::s16 && channels == noise_channels && rate == noise_sample_rate;
+  }
+
+  unsigned long bytesPerSample() const {
+    switch (encoding) {
+      case sample_encoding::s16:
+      case sample_encoding::u16:
+        return 2;
+      case sample_encoding::s24:
+        return 3;
+      case sample_encoding::s32:
+      case sample_encoding::f32:
+        return 4;
+    }
+    return 2;
+  }
+
+  unsigned long bytesPerFrame() const {
+    return bytesPerSample() * channels;
+  }
+
+  const char *name() const {
+    switch (encoding) {
+      case sample_encoding::s16:
+        return "s16";
+      case sample_encoding::u16:
+        return "u16";
+      case sample_encoding::s24:
+        return "s24";
+      case sample_encoding::s32:
+        return "s32";
+      case sample_encoding::f32:
+        return "f32";
+    }
+    return "?";
+  }
+};
+
+// parses an encoding name as printed by sample_format::name()
+inline bool parse_sample_encoding(const std::string &name, sample_encoding &encoding) {
+  static const sample_encoding all[] = {sample_encoding::s16, sample_encoding::u16, sample_encoding::s24,
+                                        sample_encoding::s32, sample_encoding::f32};
+  for (auto e : all) {
+    sample_format f;
+    f.encoding = e;
+    if (name == f.name()) {
+      encoding = e;
+      return true;
+    }
+  }
+  return false;
+}
+
+// the kernels below work on 8 samples at a time with SSE2 (also used on AVX2
+// builds, where the conversions are too cheap to benefit from wider vectors)
+// or NEON, and finish with a scalar tail.
+
+// averages interleaved stereo down to mono. out may alias in.
+inline void downmix_stereo(const int16_t *in, int16_t *out, unsigned long frames) {
+  unsigned long i = 0;
+
+#if defined(WHITENOISE_GAIN_AVX2) || defined(WHITENOISE_GAIN_SSE2)
+  const __m128i ones = _mm_set1_epi16(1);
+  for (; i + 8 <= frames; i += 8) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * i + 8));
+    // l + r per frame in 32 bits, halved, then packed back without saturating
+    __m128i lo = _mm_srai_epi32(_mm_madd_epi16(a, ones), 1);
+    __m128i hi = _mm_srai_epi32(_mm_madd_epi16(b, ones), 1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(lo, hi));
+  }
+#elif defined(WHITENOISE_GAIN_NEON)
+  for (; i + 8 <= frames; i += 8) {
+    int16x8x2_t lr = vld2q_s16(in + 2 * i);
+    vst1q_s16(out + i, vhaddq_s16(lr.val[0], lr.val[1]));
+  }
+#endif
+
+  for (; i < frames; i++) {
+    out[i] = static_cast<int16_t>((in[2 * i] + in[2 * i + 1]) >> 1);
+  }
+}
+
+inline void convert_to_u16(const int16_t *in, char *out, unsigned long samples) {
+  unsigned long i = 0;
+
+#if defined(WHITENOISE_GAIN_AVX2) || defined(WHITENOISE_GAIN_SSE2)
+  const __m128i bias = _mm_set1_epi16(static_cast<int16_t>(0x8000));
+  for (; i + 8 <= samples; i += 8) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2), _mm_xor_si128(s, bias));
+  }
+#elif defined(WHITENOISE_GAIN_NEON)
+  const uint16x8_t bias = vdupq_n_u16(0x8000);
+  for (; i + 8 <= samples; i += 8) {
+    uint16x8_t s = vreinterpretq_u16_s16(vld1q_s16(in + i));
+    vst1q_u16(reinterpret_cast<uint16_t *>(out + i * 2), veorq_u16(s, bias));
+  }
+#endif
+
+  for (; i < samples; i++) {
+    auto val = static_cast<uint16_t>(in[i] ^ 0x8000);
+    std::memcpy(out + i * 2, &val, 2);
+  }
+}
+
+inline void convert_to_s24(const int16_t *in, char *out, unsigned long samples) {
+  // three-byte samples do not map onto vector lanes; this is a byte shuffle
+  // the compiler handles well enough on its own
+  for (unsigned long i = 0; i < samples; i++) {
+    auto val = static_cast<uint16_t>(in[i]);
+    out[i * 3] = 0;
+    out[i * 3 + 1] = static_cast<char>(val & 0xff);
+    out[i * 3 + 2] = static_cast<char>(val >> 8);
+  }
+}
+
+inline void convert_to_s32(const int16_t *in, char *out, unsigned long samples) {
+  unsigned long i = 0;
+
+#if defined(WHITENOISE_GAIN_AVX2) || defined(WHITENOISE_GAIN_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 8 <= samples; i += 8) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    // interleaving zeros below each sample shifts it into the top half
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 4), _mm_unpacklo_epi16(zero, s));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 4 + 16), _mm_unpackhi_epi16(zero, s));
+  }
+#elif defined(WHITENOISE_GAIN_NEON)
+  for (; i + 8 <= samples; i += 8) {
+    int16x8_t s = vld1q_s16(in + i);
+    vst1q_s32(reinterpret_cast<int32_t *>(out + i * 4), vshll_n_s16(vget_low_s16(s), 16));
+    vst1q_s32(reinterpret_cast<int32_t *>(out + i * 4 + 16), vshll_n_s16(vget_high_s16(s), 16));
+  }
+#endif
+
+  for (; i < samples; i++) {
+    auto val = static_cast<int32_t>(static_cast<uint32_t>(static_cast<uint16_t>(in[i])) << 16);
+    std::memcpy(out + i * 4, &val, 4);
+  }
+}
+
+inline void convert_to_f32(const int16_t *in, char *out, unsigned long samples) {
+  const float scale = 1.0f / 32768;
+  unsigned long i = 0;
+
+#if defined(WHITENOISE_GAIN_AVX2) || defined(WHITENOISE_GAIN_SSE2)
+  const __m128 vscale = _mm_set1_ps(scale);
+  for (; i + 8 <= samples; i += 8) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+    _mm_storeu_ps(reinterpret_cast<float *>(out + i * 4), _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+    _mm_storeu_ps(reinterpret_cast<float *>(out + i * 4 + 16), _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+  }
+#elif defined(WHITENOISE_GAIN_NEON)
+  for (; i + 8 <= samples; i += 8) {
+    int16x8_t s = vld1q_s16(in + i);
+    float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(s)));
+    float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(s)));
+    vst1q_f32(reinterpret_cast<float *>(out + i * 4), vmulq_n_f32(lo, scale));
+    vst1q_f32(reinterpret_cast<float *>(out + i * 4 + 16), vmulq_n_f32(hi, scale));
+  }
+#endif
+
+  for (; i < samples; i++) {
+    float val = in[i] * scale;
+    std::memcpy(out + i * 4, &val, 4);
+  }
+}
+
+// converts `frames` frames of rendered stereo s16 into `fmt`. a mono format
+// is downmixed in place, so `in` is clobbered in that case.
+inline void convert_samples(int16_t *in, unsigned long frames, const sample_format &fmt, char *out) {
+  unsigned long samples = frames * noise_channels;
+
+  if (fmt.channels == 1) {
+    downmix_stereo(in, in, frames);
+    samples = frames;
+  }
+
+  switch (fmt.encoding) {
+    case sample_encoding::s16:
+      std::memcpy(out, in, samples * 2);
+      break;
+    case sample_encoding::u16:
+      convert_to_u16(in, out, samples);
+      break;
+    case sample_encoding::s24:
+      convert_to_s24(in, out, samples);
+      break;
+    case sample_encoding::s32:
+      convert_to_s32(in, out, samples);
+      break;
+    case sample_encoding::f32:
+      convert_to_f32(in, out, samples);
+      break;
+  }
+}
+
+#endif //WHITENOISE_BT_CONTROLLER_SAMPLE_FORMAT_H
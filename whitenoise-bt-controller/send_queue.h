@@ -0,0 +1,114 @@
+#ifndef WHITENOISE_BT_CONTROLLER_SEND_QUEUE_H
+#define WHITENOISE_BT_CONTROLLER_SEND_QUEUE_H
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// what is waiting to go out to one client, bounded however slowly the
+// client reads.
+//
+// messages are kept by kind so that stale ones can be dropped instead of
+// queued behind each other:
+//   replies  answers to the client's own commands, in order, up to
+//            max_reply_bytes in total
+//   status   only the newest status frame; a newer one replaces it
+//   devices  one line per discovered device address, the newest line for
+//            each, and at most max_devices of them (the oldest go first)
+class send_queue {
+ public:
+  static constexpr unsigned long max_devices = 64;
+
+  explicit send_queue(unsigned long max_reply_bytes) : max_reply_bytes(max_reply_bytes) {
+  }
+
+  // false if the reply does not fit; the client is not keeping up
+  bool pushReply(std::string_view line) {
+    if (reply_bytes + line.size() > max_reply_bytes) {
+      return false;
+    }
+
+    replies.emplace_back(line);
+    reply_bytes += line.size();
+    return true;
+  }
+
+  void setStatus(std::string_view frame) {
+    status.assign(frame.data(), frame.size());
+  }
+
+  void pushDevice(std::string_view address, std::string_view line) {
+    auto it = std::find_if(devices.begin(), devices.end(), [address](const std::pair<std::string, std::string> &d) {
+      return d.first == address;
+    });
+
+    if (it != devices.end()) {
+      device_bytes -= it->second.size();
+      devices.erase(it);
+    } else if (devices.size() == max_devices) {
+      device_bytes -= devices.front().second.size();
+      devices.pop_front();
+    }
+
+    devices.emplace_back(std::string(address), std::string(line));
+    device_bytes += line.size();
+  }
+
+  bool empty() const {
+    return replies.empty() && status.empty() && devices.empty();
+  }
+
+  unsigned long queuedBytes() const {
+    return reply_bytes + status.size() + device_bytes;
+  }
+
+  // appends whole messages to `out` until `budget` bytes are used up,
+  // replies first, then the status, then devices. always takes at least one
+  // message if there is any, however large.
+  void take(std::string &out, unsigned long budget) {
+    unsigned long start = out.size();
+    auto fits = [&](const std::string &msg) {
+      return out.size() == start || out.size() - start + msg.size() <= budget;
+    };
+
+    while (!replies.empty() && fits(replies.front())) {
+      out += replies.front();
+      reply_bytes -= replies.front().size();
+      replies.pop_front();
+    }
+
+    if (!replies.empty()) {
+      return;
+    }
+
+    if (!status.empty() && fits(status)) {
+      out += status;
+      status.clear();
+    }
+
+    if (!status.empty()) {
+      return;
+    }
+
+    while (!devices.empty() && fits(devices.front().second)) {
+      out += devices.front().second;
+      device_bytes -= devices.front().second.size();
+      devices.pop_front();
+    }
+  }
+
+ private:
+  unsigned long max_reply_bytes;
+
+  std::deque<std::string> replies;
+  unsigned long reply_bytes = 0;
+
+  std::string status;
+
+  std::deque<std::pair<std::string, std::string>> devices;
+  unsigned long device_bytes = 0;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_SEND_QUEUE_H
@@ -0,0 +1,89 @@
+#ifndef WHITENOISE_BT_CONTROLLER_SPSC_RING_H
+#define WHITENOISE_BT_CONTROLLER_SPSC_RING_H
+
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// single-producer single-consumer ring buffer. one thread writes, one thread
+// reads, neither ever blocks. capacity is rounded up to a power of two.
+template<typename T>
+class spsc_ring {
+  static_assert(std::is_trivially_copyable<T>::value, "ring elements are copied with memcpy");
+
+ public:
+  explicit spsc_ring(unsigned long min_capacity) {
+    unsigned long cap = 1;
+    while (cap < min_capacity) {
+      cap <<= 1;
+    }
+
+    buffer.resize(cap);
+    mask = cap - 1;
+  }
+
+  spsc_ring(const spsc_ring &) = delete;
+  spsc_ring &operator=(const spsc_ring &) = delete;
+
+  unsigned long capacity() const {
+    return mask + 1;
+  }
+
+  // elements available to the reader. exact on the reader side; anywhere
+  // else only a snapshot, but never negative or above capacity: tail is read
+  // first, and head cannot fall behind it.
+  unsigned long readable() const {
+    unsigned long t = tail.load(std::memory_order_acquire);
+    return std::min(head.load(std::memory_order_acquire) - t, capacity());
+  }
+
+  // producer side
+
+  unsigned long writable() const {
+    return capacity() - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+  }
+
+  // returns where the next elements go and how many of them fit without
+  // wrapping. nothing is visible to the reader until commit_write().
+  T *write_ptr(unsigned long &contiguous) {
+    unsigned long h = head.load(std::memory_order_relaxed);
+    unsigned long offset = h & mask;
+    contiguous = std::min(writable(), capacity() - offset);
+    return buffer.data() + offset;
+  }
+
+  void commit_write(unsigned long count) {
+    head.store(head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+  }
+
+  // consumer side
+
+  // copies up to count elements out of the ring and returns how many were
+  // copied
+  unsigned long read(T *out, unsigned long count) {
+    unsigned long t = tail.load(std::memory_order_relaxed);
+    count = std::min(count, head.load(std::memory_order_acquire) - t);
+
+    unsigned long offset = t & mask;
+    unsigned long first = std::min(count, capacity() - offset);
+
+    std::memcpy(out, buffer.data() + offset, first * sizeof(T));
+    std::memcpy(out + first, buffer.data(), (count - first) * sizeof(T));
+
+    tail.store(t + count, std::memory_order_release);
+    return count;
+  }
+
+ private:
+  std::vector<T> buffer;
+  unsigned long mask = 0;
+
+  // free-running counters; keep them on separate cache lines so the two
+  // threads do not false-share
+  alignas(64) std::atomic<unsigned long> head{0};
+  alignas(64) std::atomic<unsigned long> tail{0};
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_SPSC_RING_H
@@ -0,0 +1,186 @@
+#ifndef WHITENOISE_BT_CONTROLLER_STATE_STORE_H
+#define WHITENOISE_BT_CONTROLLER_STATE_STORE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// keeps small, often changing state (playing, volume, the sleep timer)
+// durable without stalling the caller.
+//
+// set() only updates memory. a background thread writes the whole state once
+// changes have stopped for `delay`, or at the latest `max_delay` after the
+// first unsaved change, so a run of volume steps costs one write. each write
+// goes to a temporary file that is fsync'd and renamed over the old one, so
+// a power cut leaves either the old state or the new one, and only this file
+// (and its directory entry) is flushed rather than the whole system.
+class state_store {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  state_store(std::string path, std::chrono::milliseconds delay,
+              std::chrono::milliseconds max_delay = std::chrono::seconds(5))
+      : path(std::move(path)), delay(delay), max_delay(std::max(delay, max_delay)) {
+    load();
+
+    writer = std::thread([this]() {
+      run();
+    });
+  }
+
+  state_store(const state_store &) = delete;
+  state_store &operator=(const state_store &) = delete;
+
+  // writes anything still pending before going away
+  ~state_store() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+    }
+    wake.notify_one();
+    writer.join();
+  }
+
+  bool get(const std::string &key, std::string &value) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = values.find(key);
+    if (it == values.end()) {
+      return false;
+    }
+    value = it->second;
+    return true;
+  }
+
+  void set(const std::string &key, const std::string &value) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = values.find(key);
+      if (it != values.end() && it->second == value) {
+        return;
+      }
+
+      values[key] = value;
+      last_change = clock::now();
+      if (!dirty) {
+        dirty = true;
+        first_change = last_change;
+      }
+    }
+    wake.notify_one();
+  }
+
+ private:
+  // a line per key, "key=value"; keys cannot contain '=' or newlines
+  void load() {
+    std::ifstream in(path);
+    std::string line;
+
+    while (std::getline(in, line)) {
+      auto eq = line.find('=');
+      if (eq != std::string::npos) {
+        values[line.substr(0, eq)] = line.substr(eq + 1);
+      }
+    }
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+      if (!dirty) {
+        if (!running) {
+          return;
+        }
+        wake.wait(lock);
+        continue;
+      }
+
+      auto due = std::min(last_change + delay, first_change + max_delay);
+      if (running && clock::now() < due) {
+        wake.wait_until(lock, due);
+        continue;
+      }
+
+      std::string contents;
+      for (const auto &kv : values) {
+        contents += kv.first + "=" + kv.second + "\n";
+      }
+      dirty = false;
+
+      lock.unlock();
+      write(contents);
+      lock.lock();
+    }
+  }
+
+  bool check(bool ok, const char *what) {
+    if (!ok) {
+      std::cerr << "state: " << what << " " << path << " failed: " << std::strerror(errno) << std::endl;
+    }
+    return ok;
+  }
+
+  void write(const std::string &contents) {
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (!check(fd >= 0, "creating temporary for")) {
+      return;
+    }
+
+    unsigned long done = 0;
+    while (done < contents.size()) {
+      ssize_t n = ::write(fd, contents.data() + done, contents.size() - done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (!check(n > 0, "writing")) {
+        ::close(fd);
+        return;
+      }
+      done += static_cast<unsigned long>(n);
+    }
+
+    bool ok = check(fsync(fd) == 0, "syncing");
+    ::close(fd);
+
+    if (!ok || !check(::rename(tmp.c_str(), path.c_str()) == 0, "replacing")) {
+      return;
+    }
+
+    // the rename itself is only durable once the directory is
+    auto slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, std::max<std::string::size_type>(slash, 1));
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+      check(fsync(dir_fd) == 0, "syncing directory of");
+      ::close(dir_fd);
+    }
+  }
+
+  const std::string path;
+  const std::chrono::milliseconds delay;
+  const std::chrono::milliseconds max_delay;
+
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  std::map<std::string, std::string> values;
+  bool dirty = false;
+  bool running = true;
+  clock::time_point first_change;
+  clock::time_point last_change;
+
+  std::thread writer;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_STATE_STORE_H
@@ -0,0 +1,210 @@
+#ifndef WHITENOISE_BT_CONTROLLER_STREAMING_SOURCE_H
+#define WHITENOISE_BT_CONTROLLER_STREAMING_SOURCE_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "noise_source.h"
+#include "thread_wakeup.h"
+
+// loops a raw PCM file of any length without holding it in memory.
+//
+// a background thread reads the file in fixed-size chunks into two buffers:
+// while the audio side plays one, the other is refilled, so memory use is two
+// chunks no matter how long the recording is. the file is read strictly in
+// order with readahead hints, and pages already played are dropped from the
+// page cache again.
+//
+// if the reader falls behind, the audio side plays silence rather than wait.
+class streaming_file_source : public noise_source {
+ public:
+  static constexpr unsigned long default_chunk_frames = noise_sample_rate; // one second
+
+  explicit streaming_file_source(const char *path, unsigned long chunk_frames = default_chunk_frames) {
+    fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      std::cerr << "could not open noise stream " << path << ": " << std::strerror(errno) << std::endl;
+      return;
+    }
+
+    struct stat st = {};
+    unsigned long frame_bytes = noise_channels * 2;
+    if (fstat(fd, &st) == 0) {
+      loop_bytes = static_cast<unsigned long>(st.st_size) / frame_bytes * frame_bytes;
+    }
+
+    if (loop_bytes == 0) {
+      std::cerr << "noise stream " << path << " is empty" << std::endl;
+      ::close(fd);
+      fd = -1;
+      return;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    for (auto &c : chunks) {
+      c.data.resize(chunk_frames * noise_channels);
+    }
+
+    std::cerr << "streaming noise file of length: " << loop_bytes
+              << " in chunks of " << chunk_frames << " frames" << std::endl;
+
+    // the first chunk is read up front so playback does not start with a gap
+    fill(chunks[0]);
+    chunks[0].ready.store(true, std::memory_order_release);
+    fill_chunk = 1;
+
+    reader = std::thread([this]() {
+      run();
+    });
+  }
+
+  streaming_file_source(const streaming_file_source &) = delete;
+  streaming_file_source &operator=(const streaming_file_source &) = delete;
+
+  ~streaming_file_source() override {
+    if (reader.joinable()) {
+      running.store(false);
+      wake.post();
+      reader.join();
+    }
+
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  const int16_t *pull(int16_t *scratch, unsigned long &samples) override {
+    // a finished chunk is only handed back now, since the samples returned by
+    // the previous call may have been read out of it
+    if (release_pending) {
+      release_pending = false;
+      chunks[cur_chunk ^ 1].ready.store(false, std::memory_order_release);
+      wake.post();
+    }
+
+    chunk &c = chunks[cur_chunk];
+
+    if (fd < 0 || !c.ready.load(std::memory_order_acquire)) {
+      if (fd >= 0) {
+        underruns.fetch_add(1, std::memory_order_relaxed);
+      }
+      std::fill(scratch, scratch + samples, 0);
+      return scratch;
+    }
+
+    samples = std::min(samples, c.data.size() - pos);
+    const int16_t *out = c.data.data() + pos;
+
+    pos += samples;
+    if (pos == c.data.size()) {
+      pos = 0;
+      cur_chunk ^= 1;
+      release_pending = true;
+    }
+
+    return out;
+  }
+
+ private:
+  struct chunk {
+    std::vector<int16_t> data;
+    std::atomic<bool> ready{false};
+  };
+
+  void run() {
+    unsigned long reported_underruns = 0;
+
+    while (running.load()) {
+      // chunks are played alternately, so they are refilled in the same order
+      chunk &c = chunks[fill_chunk];
+
+      if (!c.ready.load(std::memory_order_acquire)) {
+        fill(c);
+        c.ready.store(true, std::memory_order_release);
+        fill_chunk ^= 1;
+        continue;
+      }
+
+      unsigned long u = underruns.load(std::memory_order_relaxed);
+      if (u != reported_underruns) {
+        std::cerr << "noise stream fell behind " << u - reported_underruns << " time(s)" << std::endl;
+        reported_underruns = u;
+      }
+
+      // both chunks are full; nothing to do until the audio side releases one
+      wake.wait();
+    }
+  }
+
+  void fill(chunk &c) {
+    auto *buf = reinterpret_cast<char *>(c.data.data());
+    unsigned long want = c.data.size() * 2;
+    unsigned long got = 0;
+
+    while (got < want) {
+      unsigned long n = std::min(want - got, loop_bytes - file_pos);
+      ssize_t r = pread(fd, buf + got, n, static_cast<off_t>(file_pos));
+
+      if (r < 0 && errno == EINTR) {
+        continue;
+      }
+
+      if (r <= 0) {
+        // read error, or the file shrank underneath us
+        if (r < 0) {
+          std::cerr << "noise stream read failed: " << std::strerror(errno) << std::endl;
+        }
+        if (file_pos == 0) {
+          std::fill(buf + got, buf + want, 0);
+          return;
+        }
+        file_pos = 0;
+        continue;
+      }
+
+      // what was just read is not needed again until the next lap
+      posix_fadvise(fd, static_cast<off_t>(file_pos), r, POSIX_FADV_DONTNEED);
+
+      got += static_cast<unsigned long>(r);
+      file_pos += static_cast<unsigned long>(r);
+      if (file_pos >= loop_bytes) {
+        file_pos = 0;
+      }
+    }
+
+    // ask for the next chunk now, so the flash sees one large sequential read
+    // well before it is due
+    posix_fadvise(fd, static_cast<off_t>(file_pos), static_cast<off_t>(want), POSIX_FADV_WILLNEED);
+  }
+
+  int fd = -1;
+  unsigned long loop_bytes = 0;
+
+  chunk chunks[2];
+  std::atomic<unsigned long> underruns{0};
+
+  // audio side
+  unsigned long cur_chunk = 0;
+  unsigned long pos = 0;
+  bool release_pending = false;
+
+  // reader thread
+  unsigned long fill_chunk = 0;
+  unsigned long file_pos = 0;
+
+  thread_wakeup wake;
+  std::atomic<bool> running{true};
+  std::thread reader;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_STREAMING_SOURCE_H
@@ -0,0 +1,45 @@
+#ifndef WHITENOISE_BT_CONTROLLER_THREAD_WAKEUP_H
+#define WHITENOISE_BT_CONTROLLER_THREAD_WAKEUP_H
+
+#include <cerrno>
+
+#include <semaphore.h>
+
+// lets the audio side wake a background thread without taking a lock.
+//
+// a condition variable needs the notifier to hold the mutex, or a notify
+// that lands between the sleeper checking its condition and going to sleep
+// is lost. a semaphore counts posts instead, so the sleeper can block with
+// no timeout and still never miss one.
+class thread_wakeup {
+ public:
+  thread_wakeup() {
+    sem_init(&sem, 0, 0);
+  }
+
+  ~thread_wakeup() {
+    sem_destroy(&sem);
+  }
+
+  thread_wakeup(const thread_wakeup &) = delete;
+  thread_wakeup &operator=(const thread_wakeup &) = delete;
+
+  // never blocks; only enters the kernel if the thread is asleep
+  void post() {
+    sem_post(&sem);
+  }
+
+  // sleeps until post() has been called since the last wait(); any number of
+  // posts in between count as one
+  void wait() {
+    while (sem_wait(&sem) != 0 && errno == EINTR) {
+    }
+    while (sem_trywait(&sem) == 0) {
+    }
+  }
+
+ private:
+  sem_t sem;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_THREAD_WAKEUP_H
@@ -0,0 +1,201 @@
+#ifndef WHITENOISE_BT_CONTROLLER_TONE_FILTER_H
+#define WHITENOISE_BT_CONTROLLER_TONE_FILTER_H
+
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "noise_source.h"
+
+// tone settings as sent with the TONE command
+struct tone_settings {
+  int bass_db = 0;     // low shelf at 250 Hz, -12..12
+  int treble_db = 0;   // high shelf at 4 kHz, -12..12
+  int lowpass_hz = 0;  // 0 disables the low-pass
+
+  bool flat() const {
+    return bass_db == 0 && treble_db == 0 && lowpass_hz == 0;
+  }
+};
+
+// biquad coefficients, normalized so a0 == 1
+struct biquad_coeffs {
+  float b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+};
+
+// coefficient formulas from the RBJ audio EQ cookbook
+inline biquad_coeffs biquad_shelf(bool high, double freq, double gain_db) {
+  double a = std::pow(10.0, gain_db / 40.0);
+  double w0 = 2 * M_PI * freq / noise_sample_rate;
+  double cos_w0 = std::cos(w0);
+  double alpha = std::sin(w0) / 2 * std::sqrt(2.0); // shelf slope 1
+  double sqrt_a = 2 * std::sqrt(a) * alpha;
+  double sign = high ? -1 : 1;
+
+  double b0 = a * ((a + 1) - sign * (a - 1) * cos_w0 + sqrt_a);
+  double b1 = sign * 2 * a * ((a - 1) - sign * (a + 1) * cos_w0);
+  double b2 = a * ((a + 1) - sign * (a - 1) * cos_w0 - sqrt_a);
+  double a0 = (a + 1) + sign * (a - 1) * cos_w0 + sqrt_a;
+  double a1 = -sign * 2 * ((a - 1) + sign * (a + 1) * cos_w0);
+  double a2 = (a + 1) + sign * (a - 1) * cos_w0 - sqrt_a;
+
+  biquad_coeffs c;
+  c.b0 = static_cast<float>(b0 / a0);
+  c.b1 = static_cast<float>(b1 / a0);
+  c.b2 = static_cast<float>(b2 / a0);
+  c.a1 = static_cast<float>(a1 / a0);
+  c.a2 = static_cast<float>(a2 / a0);
+  return c;
+}
+
+inline biquad_coeffs biquad_lowpass(double freq) {
+  double w0 = 2 * M_PI * freq / noise_sample_rate;
+  double cos_w0 = std::cos(w0);
+  double alpha = std::sin(w0) / (2 * M_SQRT1_2); // Q = 1/sqrt(2)
+  double a0 = 1 + alpha;
+
+  biquad_coeffs c;
+  c.b0 = static_cast<float>((1 - cos_w0) / 2 / a0);
+  c.b1 = static_cast<float>((1 - cos_w0) / a0);
+  c.b2 = c.b0;
+  c.a1 = static_cast<float>(-2 * cos_w0 / a0);
+  c.a2 = static_cast<float>((1 - alpha) / a0);
+  return c;
+}
+
+// cascade of low shelf, high shelf and low-pass over interleaved stereo.
+//
+// set() may be called from the control thread at any time; process() picks
+// the new settings up at the start of its next call and recomputes the
+// coefficients only then. stages that would do nothing are skipped, and a
+// flat setting costs nothing at all.
+//
+// each stage has its own slot, so turning one on or off leaves the others'
+// state alone.
+class tone_filter {
+ public:
+  enum stage { bass_stage, treble_stage, lowpass_stage, max_stages };
+
+  // control side
+  void set(const tone_settings &tone) {
+    bass_db.store(std::min(std::max(tone.bass_db, -12), 12), std::memory_order_relaxed);
+    treble_db.store(std::min(std::max(tone.treble_db, -12), 12), std::memory_order_relaxed);
+    lowpass_hz.store(tone.lowpass_hz <= 0 ? 0 : std::min(std::max(tone.lowpass_hz, 200), 20000),
+                     std::memory_order_relaxed);
+    generation.fetch_add(1, std::memory_order_release);
+  }
+
+  // audio side
+
+  // returns true if process() would change the signal
+  bool active() {
+    update();
+    return stage_count > 0;
+  }
+
+  void process(int16_t *samples, unsigned long count) {
+    update();
+
+    if (stage_count == 0) {
+      return;
+    }
+
+    for (unsigned long i = 0; i < count; i += noise_channels) {
+      // both channels run through the same coefficients side by side, which
+      // the compiler can keep in one vector register
+      float x[noise_channels];
+      for (unsigned long c = 0; c < noise_channels; c++) {
+        x[c] = samples[i + c];
+      }
+
+      for (unsigned long s = 0; s < max_stages; s++) {
+        if (!enabled[s]) {
+          continue;
+        }
+
+        const biquad_coeffs &k = coeffs[s];
+        float *z1 = state[s][0];
+        float *z2 = state[s][1];
+
+        // transposed direct form II
+        for (unsigned long c = 0; c < noise_channels; c++) {
+          float y = k.b0 * x[c] + z1[c];
+          z1[c] = k.b1 * x[c] - k.a1 * y + z2[c];
+          z2[c] = k.b2 * x[c] - k.a2 * y;
+          x[c] = y;
+        }
+      }
+
+      for (unsigned long c = 0; c < noise_channels; c++) {
+        float y = std::min(std::max(x[c], -32768.0f), 32767.0f);
+        samples[i + c] = static_cast<int16_t>(std::lrint(y));
+      }
+    }
+
+    // keep a decaying tail from turning into denormals during silence
+    for (unsigned long s = 0; s < max_stages; s++) {
+      for (auto &z : state[s]) {
+        for (unsigned long c = 0; c < noise_channels; c++) {
+          if (std::fabs(z[c]) < 1e-15f) {
+            z[c] = 0;
+          }
+        }
+      }
+    }
+  }
+
+ private:
+  void update() {
+    unsigned int gen = generation.load(std::memory_order_acquire);
+
+    if (gen == applied_generation) {
+      return;
+    }
+    applied_generation = gen;
+
+    int bass = bass_db.load(std::memory_order_relaxed);
+    int treble = treble_db.load(std::memory_order_relaxed);
+    int lowpass = lowpass_hz.load(std::memory_order_relaxed);
+
+    bool next[max_stages] = {
+        bass != 0,
+        treble != 0,
+        lowpass != 0 && lowpass < static_cast<int>(noise_sample_rate / 2),
+    };
+
+    if (next[bass_stage]) {
+      coeffs[bass_stage] = biquad_shelf(false, 250, bass);
+    }
+    if (next[treble_stage]) {
+      coeffs[treble_stage] = biquad_shelf(true, 4000, treble);
+    }
+    if (next[lowpass_stage]) {
+      coeffs[lowpass_stage] = biquad_lowpass(lowpass);
+    }
+
+    // a stage that stays on keeps its state, so adjusting it does not click;
+    // one that comes on starts from silence rather than an old tail
+    stage_count = 0;
+    for (unsigned long s = 0; s < max_stages; s++) {
+      if (next[s] && !enabled[s]) {
+        std::fill(&state[s][0][0], &state[s][0][0] + 2 * noise_channels, 0.0f);
+      }
+      enabled[s] = next[s];
+      stage_count += next[s] ? 1 : 0;
+    }
+  }
+
+  std::atomic<int> bass_db{0};
+  std::atomic<int> treble_db{0};
+  std::atomic<int> lowpass_hz{0};
+  std::atomic<unsigned int> generation{0};
+
+  unsigned int applied_generation = 0;
+  biquad_coeffs coeffs[max_stages];
+  bool enabled[max_stages] = {};
+  float state[max_stages][2][noise_channels] = {};
+  unsigned long stage_count = 0;
+};
+
+#endif //WHITENOISE_BT_CONTROLLER_TONE_FILTER_H